@@ -80,6 +80,40 @@ enum
   ID_DAP_INVALID            = 0xff,
 };
 
+enum
+{
+  ID_DAP_EX_DISCOVER_CLOCK  = 0xa0,
+  ID_DAP_EX_LINK_CONFIGURE  = 0xa1,
+  ID_DAP_EX_LINK_STATUS     = 0xa2,
+  ID_DAP_EX_GANG_CONFIGURE  = 0xa3,
+  ID_DAP_EX_GANG_TRANSFER   = 0xa4,
+  ID_DAP_EX_GANG_TRANSFER_BLOCK = 0xa5,
+  ID_DAP_EX_MULTIDROP_CONFIGURE = 0xa6,
+  ID_DAP_EX_ORUN_WRITE      = 0xa7,
+  ID_DAP_EX_RECOVERY_CONFIGURE = 0xa8,
+  ID_DAP_EX_ADAPTIVE_WAIT   = 0xa9,
+  ID_DAP_EX_MATCH_TIMEOUT   = 0xaa,
+  ID_DAP_EX_WRITE_CACHE     = 0xab,
+  ID_DAP_EX_PREFETCH_CONFIGURE = 0xac,
+  ID_DAP_EX_MEM_BLOCK       = 0xad,
+  ID_DAP_EX_READ_PIPELINE   = 0xae,
+  ID_DAP_EX_STREAM          = 0xaf,
+  ID_DAP_EX_STREAM_CREDIT   = 0xb0,
+  ID_DAP_EX_STREAM_DATA     = 0xb1,
+  ID_DAP_EX_PROGRAM         = 0xb2,
+  ID_DAP_EX_SCATTER         = 0xb3,
+  ID_DAP_EX_SAMPLE_CONFIGURE = 0xb4,
+  ID_DAP_EX_SAMPLE_DATA     = 0xb5,
+  ID_DAP_EX_WATCH_CONFIGURE = 0xb6,
+  ID_DAP_EX_WATCH_EVENT     = 0xb7,
+  ID_DAP_EX_PCSR_CONFIGURE  = 0xb8,
+  ID_DAP_EX_PCSR_READ       = 0xb9,
+  ID_DAP_EX_RTT_CONFIGURE   = 0xba,
+  ID_DAP_EX_RTT_STATUS      = 0xbb,
+  ID_DAP_EX_SEMIHOST_CONFIGURE = 0xbc,
+  ID_DAP_EX_SEMIHOST_STATUS = 0xbd,
+};
+
 enum
 {
   DAP_INFO_VENDOR           = 0x01,
@@ -161,7 +195,48 @@ enum
 {
   SWD_DP_R_IDCODE           = 0x00,
   SWD_DP_W_ABORT            = 0x00,
+  SWD_DP_R_CTRL_STAT        = 0x04,
+  SWD_DP_W_CTRL_STAT        = 0x04,
+  SWD_DP_W_SELECT           = 0x08,
   SWD_DP_R_RDBUFF           = 0x0c,
+  SWD_DP_W_TARGETSEL        = 0x0c,
+};
+
+enum
+{
+  SWD_AP_CSW                = 0x00,
+  SWD_AP_TAR                = 0x04,
+  SWD_AP_DRW                = 0x0c,
+};
+
+enum
+{
+  AP_CSW_SIZE_MASK          = 0x07,
+  AP_CSW_SIZE_BYTE          = 0x00,
+  AP_CSW_SIZE_WORD          = 0x02,
+  AP_CSW_ADDRINC_MASK       = 0x30,
+  AP_CSW_ADDRINC_OFF        = 0x00,
+  AP_CSW_ADDRINC_SINGLE     = 0x10,
+  AP_CSW_ADDRINC_PACKED     = 0x20,
+};
+
+enum
+{
+  DP_ABORT_STKCMPCLR        = 1 << 1,
+  DP_ABORT_STKERRCLR        = 1 << 2,
+  DP_ABORT_WDERRCLR         = 1 << 3,
+  DP_ABORT_ORUNERRCLR       = 1 << 4,
+  DP_ABORT_CLEAR_ALL        = DP_ABORT_STKCMPCLR | DP_ABORT_STKERRCLR |
+                              DP_ABORT_WDERRCLR | DP_ABORT_ORUNERRCLR,
+};
+
+enum
+{
+  DP_CST_ORUNDETECT         = 1 << 0,
+  DP_CST_STICKYORUN         = 1 << 1,
+  DP_CST_STICKYERR          = 1 << 5,
+  DP_CST_WDATAERR           = 1 << 7,
+  DP_CST_ERRORS             = DP_CST_STICKYORUN | DP_CST_STICKYERR | DP_CST_WDATAERR,
 };
 
 enum
@@ -187,9 +262,224 @@ enum
   SWD_SEQUENCE_DIN          = 0x80,
 };
 
+enum
+{
+  DAP_PROGRAM_END           = 0x00,
+  DAP_PROGRAM_READ          = 0x01,
+  DAP_PROGRAM_WRITE         = 0x02,
+  DAP_PROGRAM_LOAD          = 0x03,
+  DAP_PROGRAM_MOV           = 0x04,
+  DAP_PROGRAM_ADD           = 0x05,
+  DAP_PROGRAM_SUB           = 0x06,
+  DAP_PROGRAM_AND           = 0x07,
+  DAP_PROGRAM_OR            = 0x08,
+  DAP_PROGRAM_XOR           = 0x09,
+  DAP_PROGRAM_SHL           = 0x0a,
+  DAP_PROGRAM_SHR           = 0x0b,
+  DAP_PROGRAM_ADDI          = 0x0c,
+  DAP_PROGRAM_ANDI          = 0x0d,
+  DAP_PROGRAM_JMP           = 0x10,
+  DAP_PROGRAM_JZ            = 0x11,
+  DAP_PROGRAM_JNZ           = 0x12,
+  DAP_PROGRAM_JEQ           = 0x13,
+  DAP_PROGRAM_JNE           = 0x14,
+  DAP_PROGRAM_JLO           = 0x15,
+  DAP_PROGRAM_DJNZ          = 0x16,
+  DAP_PROGRAM_OUT           = 0x20,
+  DAP_PROGRAM_DELAY         = 0x21,
+};
+
+enum
+{
+  DAP_RTT_STOPPED           = 0,
+  DAP_RTT_SEARCHING         = 1,
+  DAP_RTT_RUNNING           = 2,
+};
+
+enum
+{
+  DHCSR_C_DEBUGEN           = 1 << 0,
+  DHCSR_C_HALT              = 1 << 1,
+  DHCSR_C_MASKINTS          = 1 << 3,
+  DHCSR_C_SNAPSTALL         = 1 << 5,
+  DHCSR_S_REGRDY            = 1 << 16,
+  DHCSR_S_HALT              = 1 << 17,
+};
+
+enum
+{
+  DCRSR_REGWnR              = 1 << 16,
+  DFSR_HALTED               = 1 << 0,
+  DFSR_BKPT                 = 1 << 1,
+  DFSR_DWTTRAP              = 1 << 2,
+  DFSR_VCATCH               = 1 << 3,
+  DFSR_EXTERNAL             = 1 << 4,
+};
+
+enum
+{
+  SEMIHOST_SYS_OPEN         = 0x01,
+  SEMIHOST_SYS_CLOSE        = 0x02,
+  SEMIHOST_SYS_WRITEC       = 0x03,
+  SEMIHOST_SYS_WRITE0       = 0x04,
+  SEMIHOST_SYS_WRITE        = 0x05,
+  SEMIHOST_SYS_READ         = 0x06,
+  SEMIHOST_SYS_READC        = 0x07,
+  SEMIHOST_SYS_ISTTY        = 0x09,
+  SEMIHOST_SYS_CLOCK        = 0x10,
+  SEMIHOST_SYS_TIME         = 0x11,
+  SEMIHOST_SYS_ERRNO        = 0x13,
+  SEMIHOST_SYS_HEAPINFO     = 0x16,
+  SEMIHOST_SYS_EXIT         = 0x18,
+  SEMIHOST_SYS_EXIT_EXTENDED = 0x20,
+};
+
+enum
+{
+  DAP_SEMIHOST_STOPPED      = 0,
+  DAP_SEMIHOST_RUNNING      = 1,
+  DAP_SEMIHOST_CALL         = 2,
+};
+
 #define ARM_JTAG_IR_LENGTH  4
 
+// Placement of the DAP_Transfer and DAP_TransferBlock handlers, default is flash
+#ifndef DAP_CONFIG_TRANSFER_ATTR
+#define DAP_CONFIG_TRANSFER_ATTR
+#endif
+
+#define DAP_CLOCK_TIER_COUNT  8
+
+#ifdef DAP_CONFIG_ENABLE_GANG
+#if DAP_CONFIG_GANG_COUNT > 8
+  #error DAP_CONFIG_GANG_COUNT must not exceed 8
+#endif
+#define DAP_GANG_ALL_LANES  ((1ul << DAP_CONFIG_GANG_COUNT) - 1)
+#endif
+
+#define DAP_WAIT_IDLE_MAX      255
+#define DAP_WAIT_DECAY_PERIOD  64
+
+// The request is not answered while the match is pending, keep this well below host USB timeouts
+#define DAP_MATCH_TIMEOUT_MAX  1000000 // us
+
+// TAR auto-increment is only guaranteed within a 1 KB block
+#define DAP_TAR_WRAP_MASK      0x3ff
+
+#define DAP_MEM_BLOCK_SIZE_SHIFT  4
+#define DAP_MEM_BLOCK_SIZE_MASK   (3 << DAP_MEM_BLOCK_SIZE_SHIFT)
+
+#define DAP_PROGRAM_REG_COUNT     8
+
+// Not every platform can abort a running program, so the run time is limited here
+#define DAP_PROGRAM_TIME_MAX      1000000 // us
+
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+#if DAP_CONFIG_WRITE_CACHE_AP_COUNT > 32
+  #error DAP_CONFIG_WRITE_CACHE_AP_COUNT must not exceed 32
+#endif
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_PREFETCH
+#ifndef DAP_CONFIG_ENABLE_WRITE_CACHE
+  #error DAP_CONFIG_ENABLE_PREFETCH requires DAP_CONFIG_ENABLE_WRITE_CACHE
+#endif
+#define DAP_PREFETCH_WORDS  (DAP_CONFIG_PREFETCH_SIZE / 4)
+#define DAP_PREFETCH_CHUNK  16
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_STREAM
+#ifndef DAP_CONFIG_ENABLE_MEM_BLOCK
+  #error DAP_CONFIG_ENABLE_STREAM requires DAP_CONFIG_ENABLE_MEM_BLOCK
+#endif
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_SCATTER
+#ifndef DAP_CONFIG_ENABLE_MEM_BLOCK
+  #error DAP_CONFIG_ENABLE_SCATTER requires DAP_CONFIG_ENABLE_MEM_BLOCK
+#endif
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_SAMPLING
+#ifndef DAP_CONFIG_ENABLE_WRITE_CACHE
+  #error DAP_CONFIG_ENABLE_SAMPLING requires DAP_CONFIG_ENABLE_WRITE_CACHE
+#endif
+#define DAP_SAMPLE_BUF_WORDS  (DAP_CONFIG_SAMPLE_BUF_SIZE / 4)
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_WATCH
+#ifndef DAP_CONFIG_ENABLE_WRITE_CACHE
+  #error DAP_CONFIG_ENABLE_WATCH requires DAP_CONFIG_ENABLE_WRITE_CACHE
+#endif
+#if DAP_CONFIG_WATCH_COUNT > 32
+  #error DAP_CONFIG_WATCH_COUNT must not exceed 32
+#endif
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_PCSR
+#ifndef DAP_CONFIG_ENABLE_WRITE_CACHE
+  #error DAP_CONFIG_ENABLE_PCSR requires DAP_CONFIG_ENABLE_WRITE_CACHE
+#endif
+#define DAP_PCSR_ADDR   0xe000101c // DWT_PCSR
+#define DAP_PCSR_CHUNK  64
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_RTT
+#ifndef DAP_CONFIG_ENABLE_WRITE_CACHE
+  #error DAP_CONFIG_ENABLE_RTT requires DAP_CONFIG_ENABLE_WRITE_CACHE
+#endif
+#define DAP_RTT_SCAN_CHUNK   64 // words
+#define DAP_RTT_DATA_CHUNK   64 // words
+#define DAP_RTT_ID_SIZE      4  // words
+#define DAP_RTT_CB_HEADER    24 // bytes
+#define DAP_RTT_DESC_SIZE    24 // bytes
+#define DAP_RTT_DESC_WR_OFF  12 // bytes
+#define DAP_RTT_DESC_RD_OFF  16 // bytes
+#define DAP_RTT_NO_BUFFER    0xff
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_SEMIHOSTING
+#ifndef DAP_CONFIG_ENABLE_WRITE_CACHE
+  #error DAP_CONFIG_ENABLE_SEMIHOSTING requires DAP_CONFIG_ENABLE_WRITE_CACHE
+#endif
+#define DAP_SEMIHOST_DFSR         0xe000ed30
+#define DAP_SEMIHOST_DHCSR        0xe000edf0
+#define DAP_SEMIHOST_DCRSR        0xe000edf4
+#define DAP_SEMIHOST_DCRDR        0xe000edf8
+#define DAP_SEMIHOST_DBGKEY       0xa05f0000
+#define DAP_SEMIHOST_DFSR_ALL     (DFSR_HALTED | DFSR_BKPT | DFSR_DWTTRAP | DFSR_VCATCH | DFSR_EXTERNAL)
+#define DAP_SEMIHOST_BKPT         0xbeab // BKPT 0xab
+#define DAP_SEMIHOST_CHUNK        16 // words
+#define DAP_SEMIHOST_REG_RETRY    16
+#define DAP_SEMIHOST_UNTIL_ZERO   0xffffffff
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_READ_PIPELINE
+#ifndef DAP_CONFIG_ENABLE_WRITE_CACHE
+  #error DAP_CONFIG_ENABLE_READ_PIPELINE requires DAP_CONFIG_ENABLE_WRITE_CACHE
+#endif
+#endif
+
+/*- Types -------------------------------------------------------------------*/
+#if defined(DAP_CONFIG_ENABLE_SAMPLING) || defined(DAP_CONFIG_ENABLE_WATCH) || \
+    defined(DAP_CONFIG_ENABLE_PCSR) || defined(DAP_CONFIG_ENABLE_RTT) || \
+    defined(DAP_CONFIG_ENABLE_SEMIHOSTING)
+typedef struct
+{
+  uint32_t select;
+  uint32_t csw;
+  uint32_t tar;
+  bool     saved;
+  bool     clean;
+} dap_background_state_t;
+#endif
+
 /*- Constants ---------------------------------------------------------------*/
+#ifdef DAP_CONFIG_ENABLE_RTT
+// "SEGGER RTT" padded with zeros to 16 bytes
+static const uint32_t dap_rtt_id[DAP_RTT_ID_SIZE] = { 0x47474553, 0x52205245, 0x00005454, 0x00000000 };
+#endif
+
 static const struct
 {
   int    id;
@@ -233,6 +523,7 @@ static int dap_idle_cycles;
 static int dap_retry_count;
 static int dap_match_retry_count;
 static int dap_clock_delay;
+static int dap_clock_freq;
 
 static void (*dap_swj_run)(int);
 static void (*dap_swd_write)(uint32_t, int);
@@ -257,6 +548,191 @@ static bool dap_buf_error;
 static int dap_swd_turnaround;
 static bool dap_swd_data_phase;
 
+#ifdef DAP_CONFIG_ENABLE_LINK_MONITOR
+static bool dap_link_enabled;
+static int dap_link_freq;
+static int dap_link_window;
+static int dap_link_threshold;
+static int dap_link_clean_limit;
+static int dap_link_count;
+static int dap_link_errors;
+static int dap_link_clean;
+static uint32_t dap_link_total_errors;
+static uint32_t dap_link_derate_count;
+static uint32_t dap_link_uprate_count;
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_GANG
+static uint32_t dap_gang_lanes;
+static uint32_t dap_gang_active;
+static uint8_t dap_gang_ack[DAP_CONFIG_GANG_COUNT];
+static void (*dap_gang_write)(uint32_t, uint32_t, int);
+static void (*dap_gang_read)(uint32_t *, int);
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_MULTIDROP
+static int dap_multidrop_count;
+static int dap_multidrop_index;
+static uint32_t dap_multidrop_targetsel[DAP_CONFIG_MULTIDROP_COUNT];
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_ORUN_WRITE
+static bool dap_orun_write_enabled;
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_AUTO_RECOVERY
+static bool dap_recovery_enabled;
+static bool dap_recovery_line_error;
+static uint32_t dap_recovery_count;
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_MATCH_TIMEOUT
+static uint32_t dap_match_timeout;
+static int dap_match_interval;
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+static bool dap_cache_enabled;
+static bool dap_cache_select_valid;
+static uint32_t dap_cache_select;
+static uint32_t dap_cache_csw_valid;
+static uint32_t dap_cache_tar_valid;
+static uint32_t dap_cache_csw[DAP_CONFIG_WRITE_CACHE_AP_COUNT];
+static uint32_t dap_cache_tar[DAP_CONFIG_WRITE_CACHE_AP_COUNT];
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_PREFETCH
+static int dap_prefetch_range_count;
+static uint32_t dap_prefetch_range_start[DAP_CONFIG_PREFETCH_RANGE_COUNT];
+static uint32_t dap_prefetch_range_end[DAP_CONFIG_PREFETCH_RANGE_COUNT];
+static bool dap_prefetch_busy;
+static bool dap_prefetch_block_valid;
+static uint32_t dap_prefetch_block_addr;
+static int dap_prefetch_ap;
+static uint32_t dap_prefetch_csw;
+static uint32_t dap_prefetch_addr;
+static int dap_prefetch_count;
+static int dap_prefetch_size;
+static uint32_t dap_prefetch_buf[DAP_PREFETCH_WORDS];
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_STREAM
+static bool dap_stream_active;
+static bool dap_stream_read;
+static int dap_stream_size;
+static int dap_stream_credits;
+static int dap_stream_ack;
+static uint32_t dap_stream_addr;
+static uint32_t dap_stream_count;
+static uint32_t dap_stream_pos;
+static uint32_t dap_stream_done;
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_READ_PIPELINE
+static bool dap_pipeline_enabled;
+static bool dap_pipeline_open;
+static int dap_pipeline_index;
+static uint32_t dap_pipeline_addr;
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_SAMPLING
+static uint32_t dap_sample_period;
+static uint32_t dap_sample_next;
+static uint32_t dap_sample_select;
+static int dap_sample_count;
+static uint32_t dap_sample_addr[DAP_CONFIG_SAMPLE_COUNT];
+static int dap_sample_record_size;
+static int dap_sample_capacity;
+static int dap_sample_head;
+static int dap_sample_tail;
+static int dap_sample_dropped;
+static int dap_sample_credits;
+static uint32_t dap_sample_buf[DAP_SAMPLE_BUF_WORDS];
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_WATCH
+static uint32_t dap_watch_select;
+static uint32_t dap_watch_interval;
+static uint32_t dap_watch_next;
+static int dap_watch_count;
+static uint32_t dap_watch_addr[DAP_CONFIG_WATCH_COUNT];
+static uint32_t dap_watch_mask[DAP_CONFIG_WATCH_COUNT];
+static uint32_t dap_watch_value[DAP_CONFIG_WATCH_COUNT];
+static bool dap_watch_valid;
+static bool dap_watch_pending;
+static uint32_t dap_watch_changed;
+static int dap_watch_ack;
+static uint32_t dap_watch_time;
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_PCSR
+static bool dap_pcsr_enabled;
+static uint32_t dap_pcsr_select;
+static uint32_t dap_pcsr_interval;
+static uint32_t dap_pcsr_next;
+static uint32_t dap_pcsr_start;
+static int dap_pcsr_shift;
+static int dap_pcsr_count;
+static uint32_t dap_pcsr_total;
+static uint32_t dap_pcsr_halted;
+static uint32_t dap_pcsr_outside;
+static uint32_t dap_pcsr_errors;
+static uint32_t dap_pcsr_hist[DAP_CONFIG_PCSR_BUCKET_COUNT];
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_RTT
+static int dap_rtt_state;
+static uint32_t dap_rtt_select;
+static uint32_t dap_rtt_start;
+static uint32_t dap_rtt_end;
+static uint32_t dap_rtt_pos;
+static uint32_t dap_rtt_cb;
+static int dap_rtt_up_index;
+static int dap_rtt_down_index;
+static uint32_t dap_rtt_up_desc;
+static uint32_t dap_rtt_down_desc;
+static uint32_t dap_rtt_interval;
+static uint32_t dap_rtt_next;
+static int dap_rtt_up_head;
+static int dap_rtt_up_tail;
+static int dap_rtt_down_head;
+static int dap_rtt_down_tail;
+static uint8_t dap_rtt_up_buf[DAP_CONFIG_RTT_BUF_SIZE];
+static uint8_t dap_rtt_down_buf[DAP_CONFIG_RTT_BUF_SIZE];
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_SEMIHOSTING
+static bool dap_semihost_enabled;
+static uint32_t dap_semihost_select;
+static uint32_t dap_semihost_interval;
+static uint32_t dap_semihost_next;
+static uint32_t dap_semihost_timer;
+static uint64_t dap_semihost_elapsed;
+static uint32_t dap_semihost_time;
+static uint32_t dap_semihost_calls;
+static bool dap_semihost_ignore;
+static bool dap_semihost_clear;
+static bool dap_semihost_pending;
+static uint32_t dap_semihost_pc;
+static int dap_semihost_op;
+static uint32_t dap_semihost_addr;
+static uint32_t dap_semihost_size;
+static uint32_t dap_semihost_result;
+static int dap_semihost_out_head;
+static int dap_semihost_out_tail;
+static int dap_semihost_in_head;
+static int dap_semihost_in_tail;
+static uint8_t dap_semihost_out_buf[DAP_CONFIG_SEMIHOSTING_BUF_SIZE];
+static uint8_t dap_semihost_in_buf[DAP_CONFIG_SEMIHOSTING_BUF_SIZE];
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_ADAPTIVE_WAIT
+static bool dap_wait_enabled;
+static int dap_wait_ap;
+static int dap_wait_clean;
+static uint8_t dap_wait_idle[DAP_CONFIG_ADAPTIVE_WAIT_AP_COUNT];
+#endif
+
 #ifdef DAP_CONFIG_ENABLE_JTAG
 static int dap_jtag_dev_count;
 static int dap_jtag_dev_index;
@@ -331,6 +807,40 @@ DAP_SWJ_FN(fast, (void))
 DAP_SWD_FN(slow, DAP_CONFIG_DELAY)
 DAP_SWD_FN(fast, (void))
 
+#ifdef DAP_CONFIG_ENABLE_GANG
+//-----------------------------------------------------------------------------
+#define DAP_GANG_FN(ver, delay) \
+  DAP_CONFIG_PERFORMANCE_ATTR						\
+  static void dap_gang_write_##ver(uint32_t value, uint32_t lanes, int size) \
+  {									\
+    for (int i = 0; i < size; i++)					\
+    {									\
+      DAP_CONFIG_GANG_SWDIO_write((value & 1) ? lanes : 0);		\
+      DAP_CONFIG_SWCLK_TCK_clr();					\
+      delay(dap_clock_delay);						\
+      DAP_CONFIG_SWCLK_TCK_set();					\
+      delay(dap_clock_delay);						\
+      value >>= 1;							\
+    }									\
+  }									\
+									\
+  DAP_CONFIG_PERFORMANCE_ATTR						\
+  static void dap_gang_read_##ver(uint32_t *samples, int size)		\
+  {									\
+    for (int i = 0; i < size; i++)					\
+    {									\
+      DAP_CONFIG_SWCLK_TCK_clr();					\
+      delay(dap_clock_delay);						\
+      samples[i] = DAP_CONFIG_GANG_SWDIO_read();			\
+      DAP_CONFIG_SWCLK_TCK_set();					\
+      delay(dap_clock_delay);						\
+    }									\
+  }
+
+DAP_GANG_FN(slow, DAP_CONFIG_DELAY)
+DAP_GANG_FN(fast, (void))
+#endif
+
 //-----------------------------------------------------------------------------
 static inline uint32_t dap_parity(uint32_t value)
 {
@@ -343,6 +853,7 @@ static inline uint32_t dap_parity(uint32_t value)
 }
 
 //-----------------------------------------------------------------------------
+DAP_CONFIG_PERFORMANCE_ATTR
 static int dap_swd_operation(int req, uint32_t *data)
 {
   uint32_t value;
@@ -407,6 +918,8 @@ static int dap_swd_operation(int req, uint32_t *data)
   else
   {
     dap_swj_run(dap_swd_turnaround + 32 + 1);
+
+    DAP_CONFIG_SWDIO_TMS_out();
   }
 
   DAP_CONFIG_SWDIO_TMS_write(1);
@@ -414,6 +927,135 @@ static int dap_swd_operation(int req, uint32_t *data)
   return ack;
 }
 
+#ifdef DAP_CONFIG_ENABLE_GANG
+//-----------------------------------------------------------------------------
+static uint32_t dap_gang_lane_value(uint32_t *samples, int lane, int size)
+{
+  uint32_t value = 0;
+
+  for (int i = 0; i < size; i++)
+    value |= ((samples[i] >> lane) & 1) << i;
+
+  return value;
+}
+
+//-----------------------------------------------------------------------------
+DAP_CONFIG_PERFORMANCE_ATTR
+static uint32_t dap_gang_operation(int req, uint32_t lanes, uint32_t *data)
+{
+  uint32_t samples[32 + 1];
+  uint32_t ok = 0, failed = 0, error = 0;
+  int turnaround = dap_swd_turnaround;
+
+  req &= (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TRANSFER_A2 | DAP_TRANSFER_A3);
+
+  dap_gang_write(0x81 | (dap_parity(req) << 5) | (req << 1), lanes, 8);
+
+  DAP_CONFIG_GANG_SWDIO_in(lanes);
+  DAP_CONFIG_GANG_SWDIO_write(0);
+
+  dap_swj_run(turnaround);
+
+  dap_gang_read(samples, 3);
+
+  for (int lane = 0; lane < DAP_CONFIG_GANG_COUNT; lane++)
+  {
+    uint32_t mask = 1ul << lane;
+    int ack;
+
+    if (0 == (lanes & mask))
+      continue;
+
+    ack = dap_gang_lane_value(samples, lane, 3);
+    dap_gang_ack[lane] = ack;
+
+    if (DAP_TRANSFER_OK == ack)
+      ok |= mask;
+    else if (DAP_TRANSFER_WAIT == ack || DAP_TRANSFER_FAULT == ack)
+      failed |= mask;
+    else
+      error |= mask;
+  }
+
+  // Lanes that did not get an OK response are driven low (idle) while the
+  // data phase runs on the rest. Lanes with protocol errors are not driven
+  // until the full data phase has passed.
+  if (ok)
+  {
+    if (req & DAP_TRANSFER_RnW)
+    {
+      dap_gang_read(samples, turnaround);
+
+      if (!dap_swd_data_phase)
+        DAP_CONFIG_GANG_SWDIO_out(failed);
+
+      dap_gang_read(&samples[turnaround], 32 + 1 - turnaround);
+
+      for (int lane = 0; lane < DAP_CONFIG_GANG_COUNT; lane++)
+      {
+        uint32_t mask = 1ul << lane;
+        uint32_t value;
+
+        if (0 == (ok & mask))
+          continue;
+
+        value = dap_gang_lane_value(samples, lane, 32);
+
+        if (dap_parity(value) != ((samples[32] >> lane) & 1))
+        {
+          dap_gang_ack[lane] = DAP_TRANSFER_ERROR;
+          ok &= ~mask;
+        }
+
+        data[lane] = value;
+      }
+
+      dap_swj_run(turnaround);
+
+      DAP_CONFIG_GANG_SWDIO_out(lanes);
+    }
+    else
+    {
+      dap_swj_run(turnaround);
+
+      DAP_CONFIG_GANG_SWDIO_out(ok | failed);
+
+      dap_gang_write(data[0], ok, 32);
+      dap_gang_write(dap_parity(data[0]), ok, 1);
+
+      DAP_CONFIG_GANG_SWDIO_out(error);
+    }
+
+    DAP_CONFIG_GANG_SWDIO_write(0);
+    dap_swj_run(dap_idle_cycles);
+  }
+  else
+  {
+    if (dap_swd_data_phase && (req & DAP_TRANSFER_RnW))
+      dap_swj_run(32 + 1);
+
+    dap_swj_run(turnaround);
+
+    DAP_CONFIG_GANG_SWDIO_out(failed);
+
+    if (dap_swd_data_phase && (0 == (req & DAP_TRANSFER_RnW)))
+      dap_swj_run(32 + 1);
+
+    if (error)
+    {
+      if (!dap_swd_data_phase)
+        dap_swj_run(32 + 1);
+
+      DAP_CONFIG_GANG_SWDIO_out(error);
+    }
+  }
+
+  DAP_CONFIG_GANG_SWDIO_write(lanes);
+
+  return ok;
+}
+#endif // DAP_CONFIG_ENABLE_GANG
+
 #ifdef DAP_CONFIG_ENABLE_JTAG
 //-----------------------------------------------------------------------------
 #define DAP_JTAG_FN(ver, delay) \
@@ -472,6 +1114,7 @@ DAP_JTAG_FN(slow, DAP_CONFIG_DELAY)
 DAP_JTAG_FN(fast, (void))
 
 //-----------------------------------------------------------------------------
+DAP_CONFIG_TRANSFER_ATTR
 static void dap_jtag_write_ir(int ir)
 {
   int len = dap_jtag_ir_length[dap_jtag_dev_index];
@@ -509,6 +1152,7 @@ static void dap_jtag_write_ir(int ir)
 }
 
 //-----------------------------------------------------------------------------
+DAP_CONFIG_PERFORMANCE_ATTR
 static int dap_jtag_operation(int req, uint32_t *data)
 {
   int ack, ir;
@@ -601,12 +1245,18 @@ static int dap_jtag_operation(int req, uint32_t *data)
 //-----------------------------------------------------------------------------
 static void dap_setup_clock(int freq)
 {
+  dap_clock_freq = freq;
+
   if (freq > DAP_CONFIG_FAST_CLOCK)
   {
     dap_clock_delay = 0;
     dap_swj_run     = dap_swj_run_fast;
     dap_swd_write   = dap_swd_write_fast;
     dap_swd_read    = dap_swd_read_fast;
+#ifdef DAP_CONFIG_ENABLE_GANG
+    dap_gang_write  = dap_gang_write_fast;
+    dap_gang_read   = dap_gang_read_fast;
+#endif
 #ifdef DAP_CONFIG_ENABLE_JTAG
     dap_jtag_write  = dap_jtag_write_fast;
     dap_jtag_read   = dap_jtag_read_fast;
@@ -619,6 +1269,10 @@ static void dap_setup_clock(int freq)
     dap_swj_run     = dap_swj_run_slow;
     dap_swd_write   = dap_swd_write_slow;
     dap_swd_read    = dap_swd_read_slow;
+#ifdef DAP_CONFIG_ENABLE_GANG
+    dap_gang_write  = dap_gang_write_slow;
+    dap_gang_read   = dap_gang_read_slow;
+#endif
 #ifdef DAP_CONFIG_ENABLE_JTAG
     dap_jtag_write  = dap_jtag_write_slow;
     dap_jtag_read   = dap_jtag_read_slow;
@@ -628,508 +1282,1517 @@ static void dap_setup_clock(int freq)
 }
 
 //-----------------------------------------------------------------------------
-static bool dap_select_device(int index)
+static inline int dap_clock_tier_freq(int tier)
 {
-  if (DAP_PORT_SWD == dap_port)
-    return true;
+  // Tier 0 selects the fast routines, the rest halve the frequency each step
+  if (0 == tier)
+    return DAP_CONFIG_FAST_CLOCK + 1;
 
-#ifdef DAP_CONFIG_ENABLE_JTAG
-  if (DAP_PORT_JTAG == dap_port)
-  {
-    if (index >= dap_jtag_dev_count || dap_jtag_ir_length[index] != ARM_JTAG_IR_LENGTH)
-      return false;
+  return DAP_CONFIG_FAST_CLOCK >> (tier - 1);
+}
+
+#ifdef DAP_CONFIG_ENABLE_PREFETCH
+//-----------------------------------------------------------------------------
+static void dap_prefetch_invalidate(void)
+{
+  dap_prefetch_count = 0;
+  dap_prefetch_size = 0;
+}
 
-    dap_jtag_dev_index = index;
+//-----------------------------------------------------------------------------
+static void dap_prefetch_update(int req, int ack)
+{
+  if (dap_prefetch_busy || 0 == dap_prefetch_size)
+    return;
 
-    return true;
+  req &= (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TRANSFER_A2 | DAP_TRANSFER_A3);
+
+  if (DAP_TRANSFER_OK != ack || (DAP_TRANSFER_APnDP | SWD_AP_DRW) == (req & ~DAP_TRANSFER_RnW))
+  {
+    // Memory accessed by the host, buffered data may be out of date
+    dap_prefetch_invalidate();
   }
-#endif
+  else if (SWD_DP_W_SELECT == req || (DAP_TRANSFER_APnDP | SWD_AP_CSW) == req ||
+      (DAP_TRANSFER_APnDP | SWD_AP_TAR) == req)
+  {
+    // Keep the buffered data, but stop filling since the AP state has changed
+    dap_prefetch_size = dap_prefetch_count;
+  }
+  else if (0 == (req & DAP_TRANSFER_RnW))
+  {
+    dap_prefetch_invalidate();
+  }
+}
+#endif // DAP_CONFIG_ENABLE_PREFETCH
 
-  (void)index;
-  return false;
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+//-----------------------------------------------------------------------------
+static void dap_cache_invalidate(void)
+{
+  dap_cache_select_valid = false;
+  dap_cache_csw_valid = 0;
+  dap_cache_tar_valid = 0;
+
+#ifdef DAP_CONFIG_ENABLE_PREFETCH
+  dap_prefetch_invalidate();
+#endif
 }
 
 //-----------------------------------------------------------------------------
-static int dap_transfer_word(int req, uint32_t *data)
+static int dap_cache_ap(void)
 {
-  int ack = DAP_TRANSFER_INVALID;
+  int ap = dap_cache_select >> 24;
 
-  for (int i = 0; i < dap_retry_count; i++)
-  {
-    if (DAP_PORT_SWD == dap_port)
-      ack = dap_swd_operation(req, data);
-
-#ifdef DAP_CONFIG_ENABLE_JTAG
-    else if (DAP_PORT_JTAG == dap_port)
-      ack = dap_jtag_operation(req, data);
-#endif
-
-    if (DAP_TRANSFER_WAIT != ack || dap_abort)
-      break;
-  }
+  // CSW, TAR and DRW are only visible in the bank 0
+  if (!dap_cache_select_valid || (dap_cache_select & 0xf0) || ap >= DAP_CONFIG_WRITE_CACHE_AP_COUNT)
+    return -1;
 
-  return ack;
+  return ap;
 }
 
 //-----------------------------------------------------------------------------
-static bool dap_needs_posted_read(int request)
+static bool dap_cache_hit(int req, uint32_t data)
 {
-  if (0 == (request & DAP_TRANSFER_RnW))
+  int ap;
+
+  if (!dap_cache_enabled)
     return false;
 
-  if (DAP_PORT_SWD == dap_port)
-    return (request & DAP_TRANSFER_APnDP);
+  req &= (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TRANSFER_A2 | DAP_TRANSFER_A3);
 
-#ifdef DAP_CONFIG_ENABLE_JTAG
-  if (DAP_PORT_JTAG == dap_port)
-    return true;
-#endif
+  if (SWD_DP_W_SELECT == req)
+    return dap_cache_select_valid && dap_cache_select == data;
 
-  return false;
-}
+  if ((ap = dap_cache_ap()) < 0)
+    return false;
 
-//-----------------------------------------------------------------------------
-static void dap_buf_init(uint8_t *req, int req_size, uint8_t *resp, int resp_size)
-{
-  dap_req_buf  = req;
-  dap_req_size = req_size;
-  dap_req_ptr  = 0;
+  if ((DAP_TRANSFER_APnDP | SWD_AP_CSW) == req)
+    return (dap_cache_csw_valid & (1ul << ap)) && dap_cache_csw[ap] == data;
 
-  dap_resp_buf  = resp;
-  dap_resp_size = resp_size;
-  dap_resp_ptr  = 0;
+  if ((DAP_TRANSFER_APnDP | SWD_AP_TAR) == req)
+    return (dap_cache_tar_valid & (1ul << ap)) && dap_cache_tar[ap] == data;
 
-  dap_buf_error = false;
+  return false;
 }
 
 //-----------------------------------------------------------------------------
-uint8_t dap_req_get_byte(void)
+DAP_CONFIG_PERFORMANCE_ATTR
+static void dap_cache_update(int req, uint32_t *data, int ack)
 {
-  if (dap_buf_error || ((dap_req_size - dap_req_ptr) < (int)sizeof(uint8_t)))
-  {
-    dap_buf_error = true;
-    return 0;
-  }
+  uint32_t mask, csw, tar;
+  int ap;
 
-  return dap_req_buf[dap_req_ptr++];
-}
+  if (!dap_cache_enabled)
+    return;
 
-//-----------------------------------------------------------------------------
-uint16_t dap_req_get_half(void)
-{
-  if (dap_buf_error || ((dap_req_size - dap_req_ptr) < (int)sizeof(uint16_t)))
+  if (DAP_TRANSFER_OK != ack)
   {
-    dap_buf_error = true;
-    return 0;
+    dap_cache_invalidate();
+    return;
   }
 
-  uint16_t value =
-      ((uint16_t)dap_req_buf[dap_req_ptr + 1] << 8) |
-       (uint16_t)dap_req_buf[dap_req_ptr];
-  dap_req_ptr += sizeof(uint16_t);
-
-  return value;
-}
+  req &= (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TRANSFER_A2 | DAP_TRANSFER_A3);
 
-//-----------------------------------------------------------------------------
-uint32_t dap_req_get_word(void)
-{
-  if (dap_buf_error || ((dap_req_size - dap_req_ptr) < (int)sizeof(uint32_t)))
+  if (SWD_DP_W_SELECT == req)
   {
-    dap_buf_error = true;
-    return 0;
+    dap_cache_select = *data;
+    dap_cache_select_valid = true;
+    return;
   }
 
-  uint32_t value =
-      ((uint32_t)dap_req_buf[dap_req_ptr + 3] << 24) |
-      ((uint32_t)dap_req_buf[dap_req_ptr + 2] << 16) |
-      ((uint32_t)dap_req_buf[dap_req_ptr + 1] << 8) |
-       (uint32_t)dap_req_buf[dap_req_ptr];
-  dap_req_ptr += sizeof(uint32_t);
-
-  return value;
-}
-
-//-----------------------------------------------------------------------------
-void dap_resp_add_byte(uint8_t value)
-{
-  if (dap_buf_error || ((dap_resp_size - dap_resp_ptr) < (int)sizeof(uint8_t)))
+  // Power control changes may reset the APs
+  if (SWD_DP_W_CTRL_STAT == req)
   {
-    dap_buf_error = true;
+    dap_cache_csw_valid = 0;
+    dap_cache_tar_valid = 0;
     return;
   }
 
-  dap_resp_buf[dap_resp_ptr++] = value;
-}
+  if (0 == (req & DAP_TRANSFER_APnDP))
+    return;
 
-//-----------------------------------------------------------------------------
-void dap_resp_add_word(uint32_t value)
-{
-  if (dap_buf_error || ((dap_resp_size - dap_resp_ptr) < (int)sizeof(uint32_t)))
+  if (!dap_cache_select_valid)
   {
-    dap_buf_error = true;
+    // The access may have gone to any AP
+    dap_cache_csw_valid = 0;
+    dap_cache_tar_valid = 0;
     return;
   }
 
-  dap_resp_buf[dap_resp_ptr + 0] = value;
-  dap_resp_buf[dap_resp_ptr + 1] = value >> 8;
-  dap_resp_buf[dap_resp_ptr + 2] = value >> 16;
-  dap_resp_buf[dap_resp_ptr + 3] = value >> 24;
-  dap_resp_ptr += sizeof(uint32_t);
+  if ((ap = dap_cache_ap()) < 0)
+    return;
+
+  mask = 1ul << ap;
+
+  if ((DAP_TRANSFER_APnDP | SWD_AP_DRW) == (req & ~DAP_TRANSFER_RnW))
+  {
+    csw = dap_cache_csw[ap];
+    tar = dap_cache_tar[ap];
+
+    // Auto-increment past the 1 KB wrap boundary is implementation defined,
+    // sizes other than word may not be supported by the AP
+    if ((dap_cache_csw_valid & mask) && AP_CSW_ADDRINC_SINGLE == (csw & AP_CSW_ADDRINC_MASK) &&
+        AP_CSW_SIZE_WORD == (csw & AP_CSW_SIZE_MASK) && (tar & DAP_TAR_WRAP_MASK) != (DAP_TAR_WRAP_MASK & ~3u))
+      dap_cache_tar[ap] = tar + 4;
+    else if (0 == (dap_cache_csw_valid & mask) || AP_CSW_ADDRINC_OFF != (csw & AP_CSW_ADDRINC_MASK))
+      dap_cache_tar_valid &= ~mask;
+  }
+  else if ((DAP_TRANSFER_APnDP | SWD_AP_CSW) == req)
+  {
+    dap_cache_csw[ap] = *data;
+    dap_cache_csw_valid |= mask;
+  }
+  else if ((DAP_TRANSFER_APnDP | SWD_AP_TAR) == req)
+  {
+    dap_cache_tar[ap] = *data;
+    dap_cache_tar_valid |= mask;
+  }
 }
+#endif // DAP_CONFIG_ENABLE_WRITE_CACHE
 
+#ifdef DAP_CONFIG_ENABLE_MULTIDROP
 //-----------------------------------------------------------------------------
-void dap_resp_set_byte(int index, uint8_t value)
+static void dap_swd_targetsel(uint32_t value)
 {
-  if (index < dap_resp_ptr)
-    dap_resp_buf[index] = value;
+  // TARGETSEL is not acknowledged, the line is not driven during the ACK phase
+  dap_swd_write(0x81 | (dap_parity(SWD_DP_W_TARGETSEL) << 5) | (SWD_DP_W_TARGETSEL << 1), 8);
+
+  DAP_CONFIG_SWDIO_TMS_in();
+
+  dap_swj_run(dap_swd_turnaround + 3 + dap_swd_turnaround);
+
+  DAP_CONFIG_SWDIO_TMS_out();
+
+  dap_swd_write(value, 32);
+  dap_swd_write(dap_parity(value), 1);
+
+  DAP_CONFIG_SWDIO_TMS_write(1);
 }
+#endif
 
+#if defined(DAP_CONFIG_ENABLE_CLOCK_DISCOVERY) || defined(DAP_CONFIG_ENABLE_MULTIDROP) || \
+    defined(DAP_CONFIG_ENABLE_AUTO_RECOVERY)
 //-----------------------------------------------------------------------------
-bool dap_is_buf_error(void)
+static int dap_swd_reset_line(uint32_t *idcode)
 {
-  return dap_buf_error;
+  DAP_CONFIG_SWDIO_TMS_write(1);
+  dap_swd_write(0xffffffff, 32);
+  dap_swd_write(0x0003ffff, 20); // 50 ones followed by 2 idle cycles
+
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+  dap_cache_invalidate();
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_MULTIDROP
+  // Line reset deselects all targets, so the current one must be selected again
+  if (dap_multidrop_index >= 0)
+    dap_swd_targetsel(dap_multidrop_targetsel[dap_multidrop_index]);
+#endif
+
+  return dap_swd_operation(SWD_DP_R_IDCODE | DAP_TRANSFER_RnW, idcode);
 }
+#endif
 
 //-----------------------------------------------------------------------------
-static void dap_info(void)
+static bool dap_select_device(int index)
 {
-  int index = dap_req_get_byte();
-
-  if (DAP_INFO_CAPABILITIES == index)
+  if (DAP_PORT_SWD == dap_port)
   {
-    int cap = DAP_CAP_SWD;
-#ifdef DAP_CONFIG_ENABLE_JTAG
-    cap |= DAP_CAP_JTAG;
+#ifdef DAP_CONFIG_ENABLE_MULTIDROP
+    if (dap_multidrop_count)
+    {
+      if (index >= dap_multidrop_count)
+        return false;
+
+      if (index != dap_multidrop_index)
+      {
+        dap_multidrop_index = index;
+
+        if (DAP_TRANSFER_OK != dap_swd_reset_line(NULL))
+        {
+          dap_multidrop_index = -1;
+          return false;
+        }
+      }
+    }
 #endif
-    dap_resp_add_byte(1);
-    dap_resp_add_byte(cap);
+
+    return true;
   }
-  else if (DAP_INFO_PACKET_COUNT == index)
+
+#ifdef DAP_CONFIG_ENABLE_JTAG
+  if (DAP_PORT_JTAG == dap_port)
   {
-    dap_resp_add_byte(1);
-    dap_resp_add_byte(DAP_CONFIG_PACKET_COUNT);
+    if (index >= dap_jtag_dev_count || dap_jtag_ir_length[index] != ARM_JTAG_IR_LENGTH)
+      return false;
+
+    // Cached register values belong to the previously selected device
+    if (index != dap_jtag_dev_index)
+    {
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+      dap_cache_invalidate();
+#endif
+      dap_jtag_dev_index = index;
+      dap_jtag_ir = JTAG_INVALID;
+    }
+
+    return true;
   }
-  else if (DAP_INFO_PACKET_SIZE == index)
+#endif
+
+  (void)index;
+  return false;
+}
+
+#ifdef DAP_CONFIG_ENABLE_LINK_MONITOR
+//-----------------------------------------------------------------------------
+static void dap_link_step(bool down)
+{
+  int freq = dap_link_freq;
+
+  if (down)
   {
-    dap_resp_add_byte(2);
-    dap_resp_add_byte(DAP_CONFIG_PACKET_SIZE & 0xff);
-    dap_resp_add_byte((DAP_CONFIG_PACKET_SIZE >> 8) & 0xff);
+    int tier = 1;
+
+    while (tier < DAP_CLOCK_TIER_COUNT && dap_clock_tier_freq(tier) >= dap_clock_freq)
+      tier++;
+
+    if (tier == DAP_CLOCK_TIER_COUNT)
+      return;
+
+    freq = dap_clock_tier_freq(tier);
+    dap_link_derate_count++;
   }
   else
   {
-    dap_resp_add_byte(0); // Size placeholder
-
-    for (int i = 0; i < ARRAY_SIZE(dap_info_strings); i++)
+    // Never go above the frequency requested by the host
+    for (int tier = DAP_CLOCK_TIER_COUNT-1; tier >= 0; tier--)
     {
-      if (dap_info_strings[i].id == index)
+      if (dap_clock_tier_freq(tier) > dap_clock_freq)
       {
-        const char *str = dap_info_strings[i].str;
-
-        while (*str)
-          dap_resp_add_byte(*str++);
-        dap_resp_add_byte(0);
-
-        dap_resp_set_byte(1, dap_resp_ptr-2);
-
+        if (dap_clock_tier_freq(tier) < dap_link_freq)
+          freq = dap_clock_tier_freq(tier);
         break;
       }
     }
-  }
-}
 
-//-----------------------------------------------------------------------------
-static void dap_host_status(void)
-{
-  int index = dap_req_get_byte();
-  int state = dap_req_get_byte();
+    if (freq == dap_clock_freq)
+      return;
 
-  DAP_CONFIG_LED(index, state);
+    dap_link_uprate_count++;
+  }
 
-  dap_resp_add_byte(DAP_OK);
+  dap_setup_clock(freq);
 }
 
 //-----------------------------------------------------------------------------
-static void dap_connect(void)
+static void dap_link_update(int ack)
 {
-  int port = dap_req_get_byte();
-
-  if (DAP_PORT_AUTODETECT == port)
-    port = DAP_CONFIG_DEFAULT_PORT;
-
-  dap_port = DAP_PORT_DISABLED;
+  if (!dap_link_enabled)
+    return;
 
-  if (DAP_PORT_SWD == port)
+  if (DAP_TRANSFER_OK == ack || DAP_TRANSFER_WAIT == ack || DAP_TRANSFER_FAULT == ack)
   {
-    DAP_CONFIG_CONNECT_SWD();
-    dap_port = DAP_PORT_SWD;
+    if (dap_clock_freq != dap_link_freq && ++dap_link_clean >= dap_link_clean_limit)
+    {
+      dap_link_step(false);
+      dap_link_clean = 0;
+    }
   }
-
-#ifdef DAP_CONFIG_ENABLE_JTAG
-  else if (DAP_PORT_JTAG == port)
+  else // Parity or protocol error
   {
-    DAP_CONFIG_CONNECT_JTAG();
-    dap_port = DAP_PORT_JTAG;
+    dap_link_errors++;
+    dap_link_total_errors++;
+    dap_link_clean = 0;
+
+    if (dap_link_errors >= dap_link_threshold)
+    {
+      dap_link_step(true);
+      dap_link_count = dap_link_window;
+    }
   }
-#endif
 
-  dap_resp_add_byte(dap_port);
+  if (++dap_link_count >= dap_link_window)
+  {
+    dap_link_count = 0;
+    dap_link_errors = 0;
+  }
 }
+#endif // DAP_CONFIG_ENABLE_LINK_MONITOR
 
+#ifdef DAP_CONFIG_ENABLE_ADAPTIVE_WAIT
 //-----------------------------------------------------------------------------
-static void dap_disconnect(void)
+static void dap_wait_run_idle(int cycles)
 {
-  DAP_CONFIG_DISCONNECT();
-
-  dap_port = DAP_PORT_DISABLED;
+  DAP_CONFIG_SWDIO_TMS_write(0);
+  dap_swj_run(cycles);
 
-  dap_resp_add_byte(DAP_OK);
+  if (DAP_PORT_SWD == dap_port)
+    DAP_CONFIG_SWDIO_TMS_write(1);
 }
 
 //-----------------------------------------------------------------------------
-static void dap_transfer_configure(void)
+static int dap_wait_backoff(int backoff)
 {
-  dap_idle_cycles = dap_req_get_byte();
-  dap_retry_count = dap_req_get_half();
-  dap_match_retry_count = dap_req_get_half();
+  if (!dap_wait_enabled)
+    return 0;
 
-  dap_resp_add_byte(DAP_OK);
+  backoff = backoff ? (backoff * 2) : 1;
+
+  if (backoff > DAP_WAIT_IDLE_MAX)
+    backoff = DAP_WAIT_IDLE_MAX;
+
+  dap_wait_run_idle(backoff);
+
+  return backoff;
 }
 
 //-----------------------------------------------------------------------------
-static void dap_transfer(void)
+DAP_CONFIG_PERFORMANCE_ATTR
+static void dap_wait_update(int req, uint32_t *data, int ack, int backoff)
 {
-  int req_count, resp_count, request, ack;
-  bool posted_read, verify_write;
-  uint32_t data, match_value;
+  uint8_t *idle;
 
-  dap_resp_add_byte(0); // Count
-  dap_resp_add_byte(DAP_TRANSFER_INVALID);
-
-  if (!dap_select_device(dap_req_get_byte()))
+  if (!dap_wait_enabled)
     return;
 
-  req_count  = dap_req_get_byte();
-  resp_count = 0;
-
-  posted_read = false;
-  verify_write = false;
-  ack = DAP_TRANSFER_INVALID;
+  req &= (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TRANSFER_A2 | DAP_TRANSFER_A3);
 
-  for (; req_count && !dap_abort && !dap_buf_error; req_count--, resp_count++)
+  // Shadow of the APSEL field, learned values are kept per AP
+  if (SWD_DP_W_SELECT == req)
   {
-    request = dap_req_get_byte();
-    verify_write = false;
+    if (DAP_TRANSFER_OK == ack)
+      dap_wait_ap = *data >> 24;
+    return;
+  }
 
-    if (posted_read)
-    {
-      if (dap_needs_posted_read(request))
-      {
-        ack = dap_transfer_word(request, &data);
-      }
-      else
-      {
-        ack = dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, &data);
-        posted_read = false;
-      }
+  if (dap_wait_ap >= DAP_CONFIG_ADAPTIVE_WAIT_AP_COUNT)
+    return;
 
-      if (ack != DAP_TRANSFER_OK)
-        break;
+  idle = &dap_wait_idle[dap_wait_ap];
 
-      dap_resp_add_word(data);
+  if (DAP_TRANSFER_OK != ack)
+    return;
 
-      if (posted_read)
-        continue;
-    }
+  if (backoff)
+  {
+    // The last backoff step was enough to complete the transfer
+    *idle = (backoff > *idle) ? backoff : ((*idle < DAP_WAIT_IDLE_MAX) ? (*idle + 1) : *idle);
+    dap_wait_clean = 0;
+  }
+  else if (*idle && ++dap_wait_clean == DAP_WAIT_DECAY_PERIOD)
+  {
+    // Periodically try fewer cycles to track the minimum value that avoids WAITs
+    (*idle)--;
+    dap_wait_clean = 0;
+  }
 
-    if (request & DAP_TRANSFER_RnW)
-    {
-      if (request & DAP_TRANSFER_MATCH_VALUE)
-      {
-        match_value = dap_req_get_word();
+  if ((req & DAP_TRANSFER_APnDP) && *idle)
+    dap_wait_run_idle(*idle);
+}
+#endif // DAP_CONFIG_ENABLE_ADAPTIVE_WAIT
 
-        if (dap_needs_posted_read(request))
-          dap_transfer_word(request, NULL);
+//-----------------------------------------------------------------------------
+DAP_CONFIG_PERFORMANCE_ATTR
+static int dap_transfer_word(int req, uint32_t *data)
+{
+  int ack = DAP_TRANSFER_INVALID;
+#ifdef DAP_CONFIG_ENABLE_ADAPTIVE_WAIT
+  int backoff = 0;
+#endif
 
-        for (int i = 0; i < dap_match_retry_count; i++)
-        {
-          ack = dap_transfer_word(request, &data);
+  for (int i = 0; i < dap_retry_count; i++)
+  {
+    if (DAP_PORT_SWD == dap_port)
+      ack = dap_swd_operation(req, data);
 
-          if (DAP_TRANSFER_OK != ack || (data & dap_match_mask) == match_value || dap_abort)
-            break;
-        };
+#ifdef DAP_CONFIG_ENABLE_JTAG
+    else if (DAP_PORT_JTAG == dap_port)
+      ack = dap_jtag_operation(req, data);
+#endif
 
-        if ((data & dap_match_mask) != match_value)
-          ack |= DAP_TRANSFER_MISMATCH;
+#ifdef DAP_CONFIG_ENABLE_LINK_MONITOR
+    dap_link_update(ack);
+#endif
 
-        if (ack != DAP_TRANSFER_OK)
-          break;
-      }
-      else if (dap_needs_posted_read(request))
-      {
-        ack = dap_transfer_word(request, NULL);
+    if (DAP_TRANSFER_WAIT != ack || dap_abort)
+      break;
 
-        if (ack != DAP_TRANSFER_OK)
-          break;
+#ifdef DAP_CONFIG_ENABLE_ADAPTIVE_WAIT
+    // No point in waiting after the last retry
+    if ((i + 1) < dap_retry_count)
+      backoff = dap_wait_backoff(backoff);
+#endif
+  }
 
-        posted_read = true;
-      }
-      else
-      {
-        ack = dap_transfer_word(request, &data);
+#ifdef DAP_CONFIG_ENABLE_ADAPTIVE_WAIT
+  dap_wait_update(req, data, ack, backoff);
+#endif
 
-        if (DAP_TRANSFER_OK != ack)
-          break;
+#ifdef DAP_CONFIG_ENABLE_AUTO_RECOVERY
+  // A line that is stuck low returns ACK 000, which is the same value as
+  // DAP_TRANSFER_INVALID, so protocol errors are detected where the line was used
+  if (DAP_PORT_SWD == dap_port)
+  {
+    int status = ack & (DAP_TRANSFER_OK | DAP_TRANSFER_WAIT | DAP_TRANSFER_FAULT);
 
-        dap_resp_add_word(data);
-      }
-    }
-    else // Write
-    {
-      data = dap_req_get_word();
+    dap_recovery_line_error = (ack & DAP_TRANSFER_ERROR) || (DAP_TRANSFER_OK != status &&
+        DAP_TRANSFER_WAIT != status && DAP_TRANSFER_FAULT != status);
+  }
+#endif
 
-      if (request & DAP_TRANSFER_MATCH_MASK)
-      {
-        ack = DAP_TRANSFER_OK;
-        dap_match_mask = data;
-      }
-      else
-      {
-        ack = dap_transfer_word(request, &data);
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+  dap_cache_update(req, data, ack);
+#endif
 
-        if (ack != DAP_TRANSFER_OK)
-          break;
+#ifdef DAP_CONFIG_ENABLE_PREFETCH
+  dap_prefetch_update(req, ack);
+#endif
 
-        verify_write = true;
-      }
-    }
-  }
+  return ack;
+}
 
-  if (DAP_TRANSFER_OK == ack)
+#ifdef DAP_CONFIG_ENABLE_GANG
+//-----------------------------------------------------------------------------
+static uint32_t dap_gang_transfer_word(int req, uint32_t lanes, uint32_t *data)
+{
+  uint32_t pending = lanes & dap_gang_active;
+  uint32_t done = 0;
+
+  for (int i = 0; i < dap_retry_count && pending && !dap_abort; i++)
   {
-    if (posted_read)
-    {
-      ack = dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, &data);
-      dap_resp_add_word(data);
-    }
-    else if (verify_write)
+    uint32_t wait = 0;
+
+    done |= dap_gang_operation(req, pending, data);
+
+    for (int lane = 0; lane < DAP_CONFIG_GANG_COUNT; lane++)
     {
-      ack = dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, NULL);
+      if ((pending & (1ul << lane)) && DAP_TRANSFER_WAIT == dap_gang_ack[lane])
+        wait |= (1ul << lane);
     }
+
+    dap_gang_active &= ~(pending & ~done & ~wait);
+    pending = wait;
   }
 
-  dap_resp_set_byte(1, resp_count);
-  dap_resp_set_byte(2, ack);
+  // Lanes that are still waiting at this point have timed out
+  dap_gang_active &= ~pending;
+
+  return done;
 }
+#endif // DAP_CONFIG_ENABLE_GANG
 
+#ifdef DAP_CONFIG_ENABLE_AUTO_RECOVERY
 //-----------------------------------------------------------------------------
-static void dap_transfer_block(void)
+static void dap_recover(int ack)
 {
-  int req_count, resp_count, request, ack;
+  bool line_error = dap_recovery_line_error;
   uint32_t data;
 
-  dap_resp_add_byte(0); // Count
-  dap_resp_add_byte(0); // Count
-  dap_resp_add_byte(DAP_TRANSFER_INVALID);
+  dap_recovery_line_error = false;
 
-  if (!dap_select_device(dap_req_get_byte()))
+  if (!dap_recovery_enabled || DAP_PORT_SWD != dap_port || dap_abort)
     return;
 
-  req_count  = dap_req_get_half();
-  resp_count = 0;
-
-  if (0 == req_count)
+  // Protocol and parity errors mean that the line is out of sync
+  if (line_error)
+  {
+    if (DAP_TRANSFER_OK != dap_swd_reset_line(NULL))
+      return;
+  }
+  else if (DAP_TRANSFER_FAULT != (ack & (DAP_TRANSFER_OK | DAP_TRANSFER_WAIT | DAP_TRANSFER_FAULT)))
+  {
+    // Compare errors are left for the host, they are not transfer failures
     return;
+  }
 
-  request = dap_req_get_byte();
-  ack = DAP_TRANSFER_INVALID;
+  data = DP_ABORT_STKERRCLR | DP_ABORT_WDERRCLR | DP_ABORT_ORUNERRCLR;
 
-  if (request & DAP_TRANSFER_RnW)
-  {
-    bool needs_posted = dap_needs_posted_read(request);
-    int transfers = needs_posted ? (req_count + 1) : req_count;
+  if (DAP_TRANSFER_OK == dap_swd_operation(SWD_DP_W_ABORT, &data))
+    dap_recovery_count++;
+}
+#endif // DAP_CONFIG_ENABLE_AUTO_RECOVERY
 
-    for (int i = 0; i < transfers; i++)
-    {
-      if (i == req_count)
-        request = SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW;
+#if defined(DAP_CONFIG_ENABLE_PREFETCH) || defined(DAP_CONFIG_ENABLE_SAMPLING) || \
+    defined(DAP_CONFIG_ENABLE_WATCH) || defined(DAP_CONFIG_ENABLE_PCSR) || \
+    defined(DAP_CONFIG_ENABLE_RTT) || defined(DAP_CONFIG_ENABLE_SEMIHOSTING)
+//-----------------------------------------------------------------------------
+static int dap_read_ctrl_stat(uint32_t *value)
+{
+  int ack;
 
-      ack = dap_transfer_word(request, &data);
+  // CTRL/STAT is only visible with DPBANKSEL (CTRLSEL on DPv1) cleared
+  if (!dap_cache_select_valid || (dap_cache_select & 0xf))
+    return DAP_TRANSFER_INVALID;
 
-      if (DAP_TRANSFER_OK != ack)
-        break;
+  ack = dap_transfer_word(SWD_DP_R_CTRL_STAT | DAP_TRANSFER_RnW, value);
 
-      if (needs_posted && i == 0)
-        continue;
+#ifdef DAP_CONFIG_ENABLE_JTAG
+  // JTAG-DP reads are posted, the value is returned by the following scan
+  if (DAP_PORT_JTAG == dap_port && DAP_TRANSFER_OK == ack)
+    ack = dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, value);
+#endif
 
-      dap_resp_add_word(data);
-      resp_count++;
-    }
+  return ack;
+}
+
+//-----------------------------------------------------------------------------
+static void dap_clear_errors(void)
+{
+  uint32_t data;
+
+  if (DAP_PORT_SWD == dap_port)
+  {
+    data = DP_ABORT_STKERRCLR | DP_ABORT_WDERRCLR | DP_ABORT_ORUNERRCLR;
+    dap_swd_operation(SWD_DP_W_ABORT, &data);
   }
-  else // Write
+#ifdef DAP_CONFIG_ENABLE_JTAG
+  else if (DAP_PORT_JTAG == dap_port)
   {
-    for (int i = 0; i < req_count; i++)
+    // JTAG-DP sticky flags are cleared by writing ones to them
+    if (DAP_TRANSFER_OK == dap_read_ctrl_stat(&data))
     {
-      data = dap_req_get_word();
+      data |= DP_CST_STICKYORUN | DP_CST_STICKYERR;
+      dap_jtag_operation(SWD_DP_W_CTRL_STAT, &data);
+    }
+  }
+#endif
+}
+#endif
 
-      ack = dap_transfer_word(request, &data);
+#ifdef DAP_CONFIG_ENABLE_PREFETCH
+//-----------------------------------------------------------------------------
+static int dap_prefetch_serve(int request, int req_count, int *ack)
+{
+  uint32_t tar;
+  int ap, count;
 
-      if (DAP_TRANSFER_OK != ack)
-        break;
+  dap_prefetch_block_valid = false;
 
-      resp_count++;
-    }
+  if (0 == dap_prefetch_range_count ||
+      (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | SWD_AP_DRW) != (request &
+      (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TRANSFER_A2 | DAP_TRANSFER_A3)))
+    return 0;
 
-    if (DAP_TRANSFER_OK == ack)
-      ack = dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, NULL);
-  }
+  if ((ap = dap_cache_ap()) < 0 || 0 == (dap_cache_csw_valid & dap_cache_tar_valid & (1ul << ap)) ||
+      (AP_CSW_ADDRINC_SINGLE | AP_CSW_SIZE_WORD) !=
+      (dap_cache_csw[ap] & (AP_CSW_ADDRINC_MASK | AP_CSW_SIZE_MASK)))
+    return 0;
 
-  dap_resp_set_byte(1, resp_count);
-  dap_resp_set_byte(2, resp_count >> 8);
-  dap_resp_set_byte(3, ack);
+  // Remember the start of the block, prefetch continues from its end
+  dap_prefetch_block_valid = true;
+  dap_prefetch_block_addr = dap_cache_tar[ap];
+
+  if (0 == dap_prefetch_count || ap != dap_prefetch_ap || dap_cache_csw[ap] != dap_prefetch_csw ||
+      dap_cache_tar[ap] != dap_prefetch_addr)
+    return 0;
+
+  count = (req_count < dap_prefetch_count) ? req_count : dap_prefetch_count;
+
+  for (int i = 0; i < count; i++)
+    dap_resp_add_word(dap_prefetch_buf[i]);
+
+  for (int i = count; i < dap_prefetch_count; i++)
+    dap_prefetch_buf[i - count] = dap_prefetch_buf[i];
+
+  dap_prefetch_addr  += count * 4;
+  dap_prefetch_count -= count;
+  dap_prefetch_size  -= count;
+
+  // Move TAR to where the hardware would have left it
+  tar = dap_prefetch_addr;
+  dap_prefetch_busy = true;
+  *ack = dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_TAR, &tar);
+  dap_prefetch_busy = false;
+
+  return count;
 }
 
 //-----------------------------------------------------------------------------
-static void dap_transfer_abort(void)
+static void dap_prefetch_start(int count)
 {
-  // This request is handled outside of the normal queue.
-  // We should never get here.
-  dap_resp_add_byte(DAP_OK);
+  uint32_t addr = dap_prefetch_block_addr + count * 4;
+  uint32_t end = 0;
+  int ap = dap_cache_ap();
+
+  // Blocks that cross the wrap boundary leave TAR in an undefined state
+  if (!dap_prefetch_block_valid || 0 == count || ap < 0 ||
+      ((dap_prefetch_block_addr ^ (addr - 4)) & ~DAP_TAR_WRAP_MASK))
+  {
+    dap_prefetch_invalidate();
+    return;
+  }
+
+  for (int i = 0; i < dap_prefetch_range_count; i++)
+  {
+    if (dap_prefetch_range_start[i] <= addr && addr < dap_prefetch_range_end[i])
+    {
+      end = dap_prefetch_range_end[i];
+      break;
+    }
+  }
+
+  if (end > ((addr & ~DAP_TAR_WRAP_MASK) + DAP_TAR_WRAP_MASK + 1))
+    end = (addr & ~DAP_TAR_WRAP_MASK) + DAP_TAR_WRAP_MASK + 1;
+
+  if (end > addr + DAP_PREFETCH_WORDS * 4)
+    end = addr + DAP_PREFETCH_WORDS * 4;
+
+  if (end <= addr)
+  {
+    dap_prefetch_invalidate();
+    return;
+  }
+
+  // Data left after serving the request is still valid
+  if (addr != dap_prefetch_addr || ap != dap_prefetch_ap)
+    dap_prefetch_count = 0;
+
+  dap_prefetch_ap   = ap;
+  dap_prefetch_csw  = dap_cache_csw[ap];
+  dap_prefetch_addr = addr;
+  dap_prefetch_size = (end - addr) / 4;
 }
 
 //-----------------------------------------------------------------------------
-static void dap_write_abort(void)
+static void dap_prefetch_fill(void)
 {
-  int status = DAP_ERROR;
-  uint32_t data;
+  int count = dap_prefetch_size - dap_prefetch_count;
+  int req = DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | SWD_AP_DRW;
+  uint32_t tar, data;
+  int ack;
 
-  if (!dap_select_device(dap_req_get_byte()))
+  if (count <= 0)
+    return;
+
+  if (count > DAP_PREFETCH_CHUNK)
+    count = DAP_PREFETCH_CHUNK;
+
+  dap_prefetch_busy = true;
+
+  // Errors already reported by the target belong to the host, leave them alone
+  ack = dap_read_ctrl_stat(&data);
+
+  if (DAP_TRANSFER_OK != ack || (data & DP_CST_ERRORS))
   {
-    dap_resp_add_byte(DAP_ERROR);
+    dap_prefetch_busy = false;
+    dap_prefetch_size = dap_prefetch_count;
     return;
   }
 
-  data = dap_req_get_word();
+  tar = dap_prefetch_addr + dap_prefetch_count * 4;
+  ack = dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_TAR, &tar);
 
-  if (DAP_PORT_SWD == dap_port)
+  // DRW reads are posted, the last word comes from RDBUFF
+  for (int i = 0; i <= count && DAP_TRANSFER_OK == ack; i++)
   {
-    dap_swd_operation(SWD_DP_W_ABORT, &data);
-    status = DAP_OK;
+    if (i == count)
+      req = SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW;
+
+    ack = dap_transfer_word(req, &data);
+
+    if (i > 0 && DAP_TRANSFER_OK == ack)
+      dap_prefetch_buf[dap_prefetch_count + i - 1] = data;
   }
 
 #ifdef DAP_CONFIG_ENABLE_JTAG
-  else if (DAP_PORT_JTAG == dap_port)
+  // JTAG-DP does not report faults in the ACK, they are only visible in CTRL/STAT
+  if (DAP_PORT_JTAG == dap_port && DAP_TRANSFER_OK == ack)
   {
-    dap_jtag_operation(DAP_TRANSFER_JTAG_ABORT, &data);
-    status = DAP_OK;
+    ack = dap_read_ctrl_stat(&data);
+
+    if (DAP_TRANSFER_OK == ack && (data & DP_CST_ERRORS))
+      ack = DAP_TRANSFER_FAULT;
   }
 #endif
 
-  dap_resp_add_byte(status);
+  if (DAP_TRANSFER_OK == ack)
+  {
+    dap_prefetch_count += count;
+  }
+  else
+  {
+    // Errors caused by speculative reads must not be visible to the host
+    dap_clear_errors();
+
+    dap_prefetch_size = dap_prefetch_count;
+  }
+
+  // Restore TAR to the value expected by the host
+  tar = dap_prefetch_addr;
+  ack = dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_TAR, &tar);
+
+  dap_prefetch_busy = false;
+
+  if (DAP_TRANSFER_OK != ack)
+    dap_prefetch_invalidate();
 }
+#endif // DAP_CONFIG_ENABLE_PREFETCH
 
+#ifdef DAP_CONFIG_ENABLE_READ_PIPELINE
 //-----------------------------------------------------------------------------
-static void dap_delay(void)
+static void dap_pipeline_close(void)
+{
+  uint32_t data;
+
+  if (!dap_pipeline_open)
+    return;
+
+  dap_pipeline_open = false;
+
+  // A fault caused by the speculative read must not be visible to the host
+  data = DP_ABORT_STKERRCLR;
+  dap_swd_operation(SWD_DP_W_ABORT, &data);
+
+  // Move TAR back to the word after the last one returned to the host
+  data = dap_pipeline_addr;
+  dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_TAR, &data);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_pipeline_check(uint8_t *req, int req_size)
+{
+  // Only a block read of DRW on the same device can use the pending read
+  if (dap_pipeline_open && (req_size < 5 || ID_DAP_TRANSFER_BLOCK != req[0] ||
+      dap_pipeline_index != req[1] || (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | SWD_AP_DRW) !=
+      (req[4] & (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TRANSFER_A2 | DAP_TRANSFER_A3))))
+    dap_pipeline_close();
+}
+
+//-----------------------------------------------------------------------------
+static bool dap_pipeline_keep(int request, int req_count, bool primed)
+{
+  uint32_t start, next;
+  int ap;
+
+  if (!dap_pipeline_enabled || DAP_PORT_SWD != dap_port ||
+      (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | SWD_AP_DRW) != (request &
+      (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TRANSFER_A2 | DAP_TRANSFER_A3)))
+    return false;
+
+#ifdef DAP_CONFIG_ENABLE_PREFETCH
+  // Prefetch takes over sequential reads when it is configured
+  if (dap_prefetch_range_count)
+    return false;
+#endif
+
+  if ((ap = dap_cache_ap()) < 0 || 0 == (dap_cache_csw_valid & dap_cache_tar_valid & (1ul << ap)) ||
+      (AP_CSW_ADDRINC_SINGLE | AP_CSW_SIZE_WORD) !=
+      (dap_cache_csw[ap] & (AP_CSW_ADDRINC_MASK | AP_CSW_SIZE_MASK)))
+    return false;
+
+  // With a primed pipeline TAR is already one word ahead
+  start = primed ? dap_pipeline_addr : dap_cache_tar[ap];
+  next  = start + req_count * 4;
+
+  // The speculative read must not cross the wrap boundary
+  if ((start ^ next) & ~DAP_TAR_WRAP_MASK)
+    return false;
+
+  dap_pipeline_addr = next;
+
+  return true;
+}
+#endif // DAP_CONFIG_ENABLE_READ_PIPELINE
+
+//-----------------------------------------------------------------------------
+static bool dap_needs_posted_read(int request)
+{
+  if (0 == (request & DAP_TRANSFER_RnW))
+    return false;
+
+  if (DAP_PORT_SWD == dap_port)
+    return (request & DAP_TRANSFER_APnDP);
+
+#ifdef DAP_CONFIG_ENABLE_JTAG
+  if (DAP_PORT_JTAG == dap_port)
+    return true;
+#endif
+
+  return false;
+}
+
+//-----------------------------------------------------------------------------
+static void dap_buf_init(uint8_t *req, int req_size, uint8_t *resp, int resp_size)
+{
+  dap_req_buf  = req;
+  dap_req_size = req_size;
+  dap_req_ptr  = 0;
+
+  dap_resp_buf  = resp;
+  dap_resp_size = resp_size;
+  dap_resp_ptr  = 0;
+
+  dap_buf_error = false;
+}
+
+//-----------------------------------------------------------------------------
+uint8_t dap_req_get_byte(void)
+{
+  if (dap_buf_error || ((dap_req_size - dap_req_ptr) < (int)sizeof(uint8_t)))
+  {
+    dap_buf_error = true;
+    return 0;
+  }
+
+  return dap_req_buf[dap_req_ptr++];
+}
+
+//-----------------------------------------------------------------------------
+uint16_t dap_req_get_half(void)
+{
+  if (dap_buf_error || ((dap_req_size - dap_req_ptr) < (int)sizeof(uint16_t)))
+  {
+    dap_buf_error = true;
+    return 0;
+  }
+
+  uint16_t value =
+      ((uint16_t)dap_req_buf[dap_req_ptr + 1] << 8) |
+       (uint16_t)dap_req_buf[dap_req_ptr];
+  dap_req_ptr += sizeof(uint16_t);
+
+  return value;
+}
+
+//-----------------------------------------------------------------------------
+uint32_t dap_req_get_word(void)
+{
+  if (dap_buf_error || ((dap_req_size - dap_req_ptr) < (int)sizeof(uint32_t)))
+  {
+    dap_buf_error = true;
+    return 0;
+  }
+
+  uint32_t value =
+      ((uint32_t)dap_req_buf[dap_req_ptr + 3] << 24) |
+      ((uint32_t)dap_req_buf[dap_req_ptr + 2] << 16) |
+      ((uint32_t)dap_req_buf[dap_req_ptr + 1] << 8) |
+       (uint32_t)dap_req_buf[dap_req_ptr];
+  dap_req_ptr += sizeof(uint32_t);
+
+  return value;
+}
+
+//-----------------------------------------------------------------------------
+void dap_resp_add_byte(uint8_t value)
+{
+  if (dap_buf_error || ((dap_resp_size - dap_resp_ptr) < (int)sizeof(uint8_t)))
+  {
+    dap_buf_error = true;
+    return;
+  }
+
+  dap_resp_buf[dap_resp_ptr++] = value;
+}
+
+//-----------------------------------------------------------------------------
+void dap_resp_add_word(uint32_t value)
+{
+  if (dap_buf_error || ((dap_resp_size - dap_resp_ptr) < (int)sizeof(uint32_t)))
+  {
+    dap_buf_error = true;
+    return;
+  }
+
+  dap_resp_buf[dap_resp_ptr + 0] = value;
+  dap_resp_buf[dap_resp_ptr + 1] = value >> 8;
+  dap_resp_buf[dap_resp_ptr + 2] = value >> 16;
+  dap_resp_buf[dap_resp_ptr + 3] = value >> 24;
+  dap_resp_ptr += sizeof(uint32_t);
+}
+
+//-----------------------------------------------------------------------------
+void dap_resp_set_byte(int index, uint8_t value)
+{
+  if (index < dap_resp_ptr)
+    dap_resp_buf[index] = value;
+}
+
+//-----------------------------------------------------------------------------
+bool dap_is_buf_error(void)
+{
+  return dap_buf_error;
+}
+
+//-----------------------------------------------------------------------------
+static void dap_info(void)
+{
+  int index = dap_req_get_byte();
+
+  if (DAP_INFO_CAPABILITIES == index)
+  {
+    int cap = DAP_CAP_SWD;
+#ifdef DAP_CONFIG_ENABLE_JTAG
+    cap |= DAP_CAP_JTAG;
+#endif
+    dap_resp_add_byte(1);
+    dap_resp_add_byte(cap);
+  }
+  else if (DAP_INFO_PACKET_COUNT == index)
+  {
+    dap_resp_add_byte(1);
+    dap_resp_add_byte(DAP_CONFIG_PACKET_COUNT);
+  }
+  else if (DAP_INFO_PACKET_SIZE == index)
+  {
+    // Interfaces may use different packet sizes (HID reports are limited by
+    // the endpoint size), so the size of the response buffer is reported
+    int size = (dap_resp_size < DAP_CONFIG_PACKET_SIZE) ? dap_resp_size : DAP_CONFIG_PACKET_SIZE;
+
+    dap_resp_add_byte(2);
+    dap_resp_add_byte(size & 0xff);
+    dap_resp_add_byte((size >> 8) & 0xff);
+  }
+  else
+  {
+    dap_resp_add_byte(0); // Size placeholder
+
+    for (int i = 0; i < ARRAY_SIZE(dap_info_strings); i++)
+    {
+      if (dap_info_strings[i].id == index)
+      {
+        const char *str = dap_info_strings[i].str;
+
+        while (*str)
+          dap_resp_add_byte(*str++);
+        dap_resp_add_byte(0);
+
+        dap_resp_set_byte(1, dap_resp_ptr-2);
+
+        break;
+      }
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void dap_host_status(void)
+{
+  int index = dap_req_get_byte();
+  int state = dap_req_get_byte();
+
+  DAP_CONFIG_LED(index, state);
+
+  dap_resp_add_byte(DAP_OK);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_connect(void)
+{
+  int port = dap_req_get_byte();
+
+  if (DAP_PORT_AUTODETECT == port)
+    port = DAP_CONFIG_DEFAULT_PORT;
+
+  dap_port = DAP_PORT_DISABLED;
+
+#ifdef DAP_CONFIG_ENABLE_GANG
+  dap_gang_lanes = 0;
+  DAP_CONFIG_GANG_SWDIO_in(DAP_GANG_ALL_LANES);
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_MULTIDROP
+  dap_multidrop_index = -1;
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+  dap_cache_invalidate();
+#endif
+
+  if (DAP_PORT_SWD == port)
+  {
+    DAP_CONFIG_CONNECT_SWD();
+    dap_port = DAP_PORT_SWD;
+  }
+
+#ifdef DAP_CONFIG_ENABLE_JTAG
+  else if (DAP_PORT_JTAG == port)
+  {
+    DAP_CONFIG_CONNECT_JTAG();
+    dap_port = DAP_PORT_JTAG;
+  }
+#endif
+
+  dap_resp_add_byte(dap_port);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_disconnect(void)
+{
+  DAP_CONFIG_DISCONNECT();
+
+#ifdef DAP_CONFIG_ENABLE_GANG
+  dap_gang_lanes = 0;
+  DAP_CONFIG_GANG_SWDIO_in(DAP_GANG_ALL_LANES);
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_MULTIDROP
+  dap_multidrop_index = -1;
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+  dap_cache_invalidate();
+#endif
+
+  dap_port = DAP_PORT_DISABLED;
+
+  dap_resp_add_byte(DAP_OK);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_transfer_configure(void)
+{
+  dap_idle_cycles = dap_req_get_byte();
+  dap_retry_count = dap_req_get_half();
+  dap_match_retry_count = dap_req_get_half();
+
+  dap_resp_add_byte(DAP_OK);
+}
+
+#ifdef DAP_CONFIG_ENABLE_MATCH_TIMEOUT
+//-----------------------------------------------------------------------------
+static int dap_match_timed(int request, uint32_t match_value, uint32_t *data)
+{
+  uint32_t start = DAP_CONFIG_TIMER_US();
+  int ack;
+
+  while (1)
+  {
+    ack = dap_transfer_word(request, data);
+
+    if (DAP_TRANSFER_OK != ack || (*data & dap_match_mask) == match_value || dap_abort)
+      break;
+
+    if ((DAP_CONFIG_TIMER_US() - start) >= dap_match_timeout)
+      break;
+
+    dap_delay_us(dap_match_interval);
+  }
+
+  return ack;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+DAP_CONFIG_TRANSFER_ATTR
+static void dap_transfer(void)
+{
+  int req_count, resp_count, request, ack;
+  bool posted_read, verify_write;
+  uint32_t data, match_value;
+
+  dap_resp_add_byte(0); // Count
+  dap_resp_add_byte(DAP_TRANSFER_INVALID);
+
+  if (!dap_select_device(dap_req_get_byte()))
+    return;
+
+  req_count  = dap_req_get_byte();
+  resp_count = 0;
+
+  posted_read = false;
+  verify_write = false;
+  ack = DAP_TRANSFER_INVALID;
+
+  for (; req_count && !dap_abort && !dap_buf_error; req_count--, resp_count++)
+  {
+    request = dap_req_get_byte();
+    verify_write = false;
+
+    if (posted_read)
+    {
+      if (dap_needs_posted_read(request))
+      {
+        ack = dap_transfer_word(request, &data);
+      }
+      else
+      {
+        ack = dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, &data);
+        posted_read = false;
+      }
+
+      if (ack != DAP_TRANSFER_OK)
+        break;
+
+      dap_resp_add_word(data);
+
+      if (posted_read)
+        continue;
+    }
+
+    if (request & DAP_TRANSFER_RnW)
+    {
+      if (request & DAP_TRANSFER_MATCH_VALUE)
+      {
+        match_value = dap_req_get_word();
+
+        if (dap_needs_posted_read(request))
+          dap_transfer_word(request, NULL);
+
+#ifdef DAP_CONFIG_ENABLE_MATCH_TIMEOUT
+        // Time based timeout replaces the retry count when configured
+        if (dap_match_timeout)
+          ack = dap_match_timed(request, match_value, &data);
+        else
+#endif
+        for (int i = 0; i < dap_match_retry_count; i++)
+        {
+          ack = dap_transfer_word(request, &data);
+
+          if (DAP_TRANSFER_OK != ack || (data & dap_match_mask) == match_value || dap_abort)
+            break;
+        };
+
+        if ((data & dap_match_mask) != match_value)
+          ack |= DAP_TRANSFER_MISMATCH;
+
+        if (ack != DAP_TRANSFER_OK)
+          break;
+      }
+      else if (dap_needs_posted_read(request))
+      {
+        ack = dap_transfer_word(request, NULL);
+
+        if (ack != DAP_TRANSFER_OK)
+          break;
+
+        posted_read = true;
+      }
+      else
+      {
+        ack = dap_transfer_word(request, &data);
+
+        if (DAP_TRANSFER_OK != ack)
+          break;
+
+        dap_resp_add_word(data);
+      }
+    }
+    else // Write
+    {
+      data = dap_req_get_word();
+
+      if (request & DAP_TRANSFER_MATCH_MASK)
+      {
+        ack = DAP_TRANSFER_OK;
+        dap_match_mask = data;
+      }
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+      else if (dap_cache_hit(request, data))
+      {
+        // The register already holds this value, no need to write it again
+        ack = DAP_TRANSFER_OK;
+      }
+#endif
+      else
+      {
+        ack = dap_transfer_word(request, &data);
+
+        if (ack != DAP_TRANSFER_OK)
+          break;
+
+        verify_write = true;
+      }
+    }
+  }
+
+  if (DAP_TRANSFER_OK == ack)
+  {
+    if (posted_read)
+    {
+      ack = dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, &data);
+      dap_resp_add_word(data);
+    }
+    else if (verify_write)
+    {
+      ack = dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, NULL);
+    }
+  }
+
+#ifdef DAP_CONFIG_ENABLE_AUTO_RECOVERY
+  dap_recover(ack);
+#endif
+
+  dap_resp_set_byte(1, resp_count);
+  dap_resp_set_byte(2, ack);
+}
+
+#ifdef DAP_CONFIG_ENABLE_ORUN_WRITE
+//-----------------------------------------------------------------------------
+DAP_CONFIG_PERFORMANCE_ATTR
+static int dap_swd_stream_write(int req, uint32_t data)
+{
+  int ack;
+
+  dap_swd_write(0x81 | (dap_parity(req) << 5) | (req << 1), 8);
+
+  DAP_CONFIG_SWDIO_TMS_in();
+
+  dap_swj_run(dap_swd_turnaround);
+
+  ack = dap_swd_read(3);
+
+  dap_swj_run(dap_swd_turnaround);
+
+  DAP_CONFIG_SWDIO_TMS_out();
+
+  // With ORUNDETECT set the data phase is required regardless of the ACK
+  dap_swd_write(data, 32);
+  dap_swd_write(dap_parity(data), 1);
+
+  DAP_CONFIG_SWDIO_TMS_write(0);
+  dap_swj_run(dap_idle_cycles);
+  DAP_CONFIG_SWDIO_TMS_write(1);
+
+  return ack;
+}
+
+//-----------------------------------------------------------------------------
+static bool dap_orun_write_match(int request)
+{
+  return dap_orun_write_enabled && DAP_PORT_SWD == dap_port &&
+      (DAP_TRANSFER_APnDP | SWD_AP_DRW) == (request & (DAP_TRANSFER_APnDP |
+      DAP_TRANSFER_RnW | DAP_TRANSFER_A2 | DAP_TRANSFER_A3));
+}
+
+//-----------------------------------------------------------------------------
+static int dap_orun_write_block(int request, int req_count, int *resp_count)
+{
+  uint32_t ctrl_stat, data, abort;
+  int ack, status;
+
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+  // Streamed writes bypass the state tracking
+  dap_cache_invalidate();
+#endif
+
+  ack = dap_transfer_word(SWD_DP_R_CTRL_STAT | DAP_TRANSFER_RnW, &ctrl_stat);
+
+  if (DAP_TRANSFER_OK != ack)
+    return ack;
+
+  data = ctrl_stat | DP_CST_ORUNDETECT;
+  ack = dap_transfer_word(SWD_DP_W_CTRL_STAT, &data);
+
+  if (DAP_TRANSFER_OK != ack)
+    return ack;
+
+  request &= (DAP_TRANSFER_APnDP | DAP_TRANSFER_A2 | DAP_TRANSFER_A3);
+
+  for (int i = 0; i < req_count; i++)
+  {
+    ack = dap_swd_stream_write(request, dap_req_get_word());
+
+#ifdef DAP_CONFIG_ENABLE_LINK_MONITOR
+    dap_link_update(ack);
+#endif
+
+    if (DAP_TRANSFER_OK != ack || dap_abort)
+      break;
+
+    (*resp_count)++;
+  }
+
+  // CTRL/STAT reads are never stalled, so a single read validates the whole stream
+  status = dap_swd_operation(SWD_DP_R_CTRL_STAT | DAP_TRANSFER_RnW, &data);
+
+  if (DAP_TRANSFER_OK == ack && (DAP_TRANSFER_OK != status || (data & DP_CST_ERRORS)))
+  {
+    ack = (DAP_TRANSFER_OK == status) ? DAP_TRANSFER_FAULT : status;
+    *resp_count = 0;
+  }
+
+  // A stall while ORUNDETECT is still set raises STICKYORUN, so the flag is
+  // cleared before each attempt to restore the original CTRL/STAT value.
+  // Other sticky errors also block the write, they are already reported as a
+  // FAULT at this point and get cleared as well.
+  abort = DP_ABORT_ORUNERRCLR;
+
+  for (int i = 0; i < dap_retry_count; i++)
+  {
+    dap_swd_stream_write(SWD_DP_W_ABORT, abort);
+
+    status = dap_swd_stream_write(SWD_DP_W_CTRL_STAT, ctrl_stat);
+
+    if (DAP_TRANSFER_FAULT == status)
+      abort = DP_ABORT_CLEAR_ALL;
+    else if (DAP_TRANSFER_WAIT != status || dap_abort)
+      break;
+  }
+
+  if (DAP_TRANSFER_OK == ack)
+    ack = (DAP_TRANSFER_OK == status) ? dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, NULL) : status;
+
+  return ack;
+}
+#endif // DAP_CONFIG_ENABLE_ORUN_WRITE
+
+//-----------------------------------------------------------------------------
+DAP_CONFIG_TRANSFER_ATTR
+static void dap_transfer_block(void)
+{
+  int req_count, resp_count, request, index, ack;
+  uint32_t data;
+
+  dap_resp_add_byte(0); // Count
+  dap_resp_add_byte(0); // Count
+  dap_resp_add_byte(DAP_TRANSFER_INVALID);
+
+  index = dap_req_get_byte();
+
+  if (!dap_select_device(index))
+    return;
+
+  req_count  = dap_req_get_half();
+  resp_count = 0;
+
+  if (0 == req_count)
+    return;
+
+  request = dap_req_get_byte();
+  ack = DAP_TRANSFER_INVALID;
+
+  if (request & DAP_TRANSFER_RnW)
+  {
+    bool needs_posted = dap_needs_posted_read(request);
+    bool keep_open = false;
+    int transfers, first = 0;
+
+#ifdef DAP_CONFIG_ENABLE_PREFETCH
+    // Words served from the prefetch buffer are not read again
+    resp_count = dap_prefetch_serve(request, req_count, &ack);
+    req_count -= resp_count;
+
+    if (resp_count && DAP_TRANSFER_OK != ack)
+      req_count = 0;
+#endif
+
+    transfers = (needs_posted && req_count) ? (req_count + 1) : req_count;
+
+#ifdef DAP_CONFIG_ENABLE_READ_PIPELINE
+    // The first read was issued by the previous request, the last one is
+    // left pending for the next request instead of reading RDBUFF
+    if (dap_pipeline_open && 0 == req_count)
+      dap_pipeline_close(); // Nothing is left to consume the pending read
+    else if (dap_pipeline_open)
+      first = 1;
+
+    if (req_count)
+      keep_open = dap_pipeline_keep(request, req_count, dap_pipeline_open);
+
+    dap_pipeline_open = false;
+#endif
+
+    for (int i = first; i < transfers; i++)
+    {
+      if (i == req_count && !keep_open)
+        request = SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW;
+
+      ack = dap_transfer_word(request, &data);
+
+      if (DAP_TRANSFER_OK != ack)
+        break;
+
+      if (needs_posted && i == 0)
+        continue;
+
+      dap_resp_add_word(data);
+      resp_count++;
+    }
+
+#ifdef DAP_CONFIG_ENABLE_PREFETCH
+    if (DAP_TRANSFER_OK == ack)
+      dap_prefetch_start(resp_count);
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_READ_PIPELINE
+    if (keep_open && DAP_TRANSFER_OK == ack)
+    {
+      dap_pipeline_open = true;
+      dap_pipeline_index = index;
+    }
+#endif
+  }
+#ifdef DAP_CONFIG_ENABLE_ORUN_WRITE
+  else if (dap_orun_write_match(request))
+  {
+    ack = dap_orun_write_block(request, req_count, &resp_count);
+  }
+#endif
+  else // Write
+  {
+    for (int i = 0; i < req_count; i++)
+    {
+      data = dap_req_get_word();
+
+      ack = dap_transfer_word(request, &data);
+
+      if (DAP_TRANSFER_OK != ack)
+        break;
+
+      resp_count++;
+    }
+
+    if (DAP_TRANSFER_OK == ack)
+      ack = dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, NULL);
+  }
+
+#ifdef DAP_CONFIG_ENABLE_AUTO_RECOVERY
+  dap_recover(ack);
+#endif
+
+  dap_resp_set_byte(1, resp_count);
+  dap_resp_set_byte(2, resp_count >> 8);
+  dap_resp_set_byte(3, ack);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_transfer_abort(void)
+{
+  // This request is handled outside of the normal queue.
+  // We should never get here.
+  dap_resp_add_byte(DAP_OK);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_write_abort(void)
+{
+  int status = DAP_ERROR;
+  uint32_t data;
+
+  if (!dap_select_device(dap_req_get_byte()))
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    return;
+  }
+
+  data = dap_req_get_word();
+
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+  // DAPABORT may leave an AP transaction incomplete
+  dap_cache_invalidate();
+#endif
+
+  if (DAP_PORT_SWD == dap_port)
+  {
+    dap_swd_operation(SWD_DP_W_ABORT, &data);
+    status = DAP_OK;
+  }
+
+#ifdef DAP_CONFIG_ENABLE_JTAG
+  else if (DAP_PORT_JTAG == dap_port)
+  {
+    dap_jtag_operation(DAP_TRANSFER_JTAG_ABORT, &data);
+    status = DAP_OK;
+  }
+#endif
+
+  dap_resp_add_byte(status);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_delay(void)
 {
   int delay = dap_req_get_half();
   dap_delay_us(delay);
@@ -1137,276 +2800,3188 @@ static void dap_delay(void)
 }
 
 //-----------------------------------------------------------------------------
-static void dap_reset_target(void)
+static void dap_reset_target(void)
+{
+  dap_resp_add_byte(DAP_OK);
+
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+  dap_cache_invalidate();
+#endif
+
+#ifdef DAP_CONFIG_RESET_TARGET_FN
+  DAP_CONFIG_RESET_TARGET_FN();
+  dap_resp_add_byte(1);
+#else
+  dap_resp_add_byte(0);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+static void dap_swj_pins(void)
+{
+  int value  = dap_req_get_byte();
+  int select = dap_req_get_byte();
+  int wait   = dap_req_get_word();
+
+  if (select & DAP_SWJ_SWCLK_TCK)
+    DAP_CONFIG_SWCLK_TCK_write(value & DAP_SWJ_SWCLK_TCK);
+
+  if (select & DAP_SWJ_SWDIO_TMS)
+    DAP_CONFIG_SWDIO_TMS_write(value & DAP_SWJ_SWDIO_TMS);
+
+  if (select & DAP_SWJ_TDI)
+    DAP_CONFIG_TDI_write(value & DAP_SWJ_TDI);
+
+  if (select & DAP_SWJ_nTRST)
+    DAP_CONFIG_nTRST_write(value & DAP_SWJ_nTRST);
+
+  if (select & DAP_SWJ_nRESET)
+    DAP_CONFIG_nRESET_write(value & DAP_SWJ_nRESET);
+
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+  if (select)
+    dap_cache_invalidate();
+#endif
+
+  dap_delay_us(wait * 1000);
+
+  value =
+    (DAP_CONFIG_SWCLK_TCK_read() ? DAP_SWJ_SWCLK_TCK : 0) |
+    (DAP_CONFIG_SWDIO_TMS_read() ? DAP_SWJ_SWDIO_TMS : 0) |
+    (DAP_CONFIG_TDI_read()       ? DAP_SWJ_TDI       : 0) |
+    (DAP_CONFIG_TDO_read()       ? DAP_SWJ_TDO       : 0) |
+    (DAP_CONFIG_nTRST_read()     ? DAP_SWJ_nTRST     : 0) |
+    (DAP_CONFIG_nRESET_read()    ? DAP_SWJ_nRESET    : 0);
+
+  dap_resp_add_byte(value);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_swj_clock(void)
+{
+  int freq = dap_req_get_word();
+  dap_setup_clock(freq);
+#ifdef DAP_CONFIG_ENABLE_LINK_MONITOR
+  dap_link_freq = freq;
+  dap_link_clean = 0;
+#endif
+  dap_resp_add_byte(DAP_OK);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_swj_sequence(void)
+{
+  int size = dap_req_get_byte();
+
+#ifdef DAP_CONFIG_ENABLE_MULTIDROP
+  // The sequence may deselect the target, force selection on the next transfer
+  dap_multidrop_index = -1;
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+  dap_cache_invalidate();
+#endif
+
+  while (size)
+  {
+    int sz = (size > 8) ? 8 : size;
+
+#ifdef DAP_CONFIG_ENABLE_GANG
+    // In gang mode sequences go to all configured lanes instead of SWDIO
+    if (dap_gang_lanes)
+      dap_gang_write(dap_req_get_byte(), dap_gang_lanes, sz);
+    else
+#endif
+    dap_swd_write(dap_req_get_byte(), sz);
+
+    size -= sz;
+  }
+
+  dap_resp_add_byte(DAP_OK);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_swd_configure(void)
+{
+  int data = dap_req_get_byte();
+
+  dap_swd_turnaround = (data & 3) + 1;
+  dap_swd_data_phase = (data & 4) ? 1 : 0;
+
+  dap_resp_add_byte(DAP_OK);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_swd_sequence(void)
+{
+  int req_count;
+
+  if (DAP_PORT_SWD != dap_port)
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    return;
+  }
+
+  dap_resp_add_byte(DAP_OK);
+
+#ifdef DAP_CONFIG_ENABLE_MULTIDROP
+  dap_multidrop_index = -1;
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+  dap_cache_invalidate();
+#endif
+
+  req_count = dap_req_get_byte();
+
+  for (int i = 0; i < req_count; i++)
+  {
+    int info  = dap_req_get_byte();
+    int count = info & SWD_SEQUENCE_COUNT;
+    int din   = info & SWD_SEQUENCE_DIN;
+
+    if (count == 0)
+      count = 64U;
+
+    if (din)
+    {
+      DAP_CONFIG_SWDIO_TMS_in();
+
+      while (count)
+      {
+        int sz = (count > 8) ? 8 : count;
+        int value = dap_swd_read(sz);
+        dap_resp_add_byte(value);
+        count -= sz;
+      }
+    }
+    else
+    {
+      DAP_CONFIG_SWDIO_TMS_out();
+
+      while (count)
+      {
+        int sz = (count > 8) ? 8 : count;
+        dap_swd_write(dap_req_get_byte(), sz);
+        count -= sz;
+      }
+    }
+  }
+
+  DAP_CONFIG_SWDIO_TMS_out();
+}
+
+//-----------------------------------------------------------------------------
+static void dap_jtag_sequence(void)
+{
+#ifdef DAP_CONFIG_ENABLE_JTAG
+  int req_count;
+
+  if (DAP_PORT_JTAG != dap_port)
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    return;
+  }
+
+  dap_resp_add_byte(DAP_OK);
+
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+  dap_cache_invalidate();
+#endif
+
+  req_count = dap_req_get_byte();
+
+  for (int i = 0; i < req_count; i++)
+  {
+    int info  = dap_req_get_byte();
+    int count = info & JTAG_SEQUENCE_COUNT;
+    int tms   = info & JTAG_SEQUENCE_TMS;
+    int tdo   = info & JTAG_SEQUENCE_TDO;
+
+    if (count == 0)
+      count = 64;
+
+    DAP_CONFIG_SWDIO_TMS_write(tms);
+
+    while (count)
+    {
+      int sz = (count > 8) ? 8 : count;
+
+      if (tdo)
+      {
+        int value = dap_jtag_rdwr(dap_req_get_byte(), sz);
+        dap_resp_add_byte(value);
+      }
+      else
+      {
+        dap_jtag_write(dap_req_get_byte(), sz);
+      }
+
+      count -= sz;
+    }
+  }
+#else
+  dap_resp_add_byte(DAP_ERROR);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+static void dap_jtag_configure(void)
+{
+#ifdef DAP_CONFIG_ENABLE_JTAG
+  int count = dap_req_get_byte();
+  int bits = 0;
+
+  if (count > DAP_CONFIG_JTAG_DEV_COUNT)
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    return;
+  }
+
+  dap_jtag_dev_count = count;
+  dap_jtag_dev_index = 0;
+
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+  dap_cache_invalidate();
+#endif
+
+  for (int i = 0; i < dap_jtag_dev_count; i++)
+  {
+    dap_jtag_ir_length[i] = dap_req_get_byte();
+    dap_jtag_ir_before[i] = bits;
+    bits += dap_jtag_ir_length[i];
+  }
+
+  for (int i = 0; i < dap_jtag_dev_count; i++)
+  {
+    bits -= dap_jtag_ir_length[i];
+    dap_jtag_ir_after[i] = bits;
+  }
+
+  dap_resp_add_byte(DAP_OK);
+#else
+  dap_resp_add_byte(DAP_ERROR);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+static void dap_jtag_idcode(void)
+{
+#ifdef DAP_CONFIG_ENABLE_JTAG
+  uint32_t data;
+
+  if (DAP_PORT_JTAG != dap_port || !dap_select_device(dap_req_get_byte()))
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    return;
+  }
+
+  dap_jtag_write_ir(JTAG_IDCODE);
+
+  DAP_CONFIG_SWDIO_TMS_write(1);
+  dap_swj_run(1); // -> Select-DR-Scan
+  DAP_CONFIG_SWDIO_TMS_write(0);
+  dap_swj_run(2 + dap_jtag_dev_index); // -> Shift-DR
+
+  data = dap_jtag_read(31);
+
+  DAP_CONFIG_SWDIO_TMS_write(1);
+  data |= (dap_jtag_read(1) << 31); // -> Exit1-DR
+
+  dap_swj_run(1); // -> Update-DR
+  DAP_CONFIG_SWDIO_TMS_write(0);
+  dap_swj_run(1); // -> Idle
+  DAP_CONFIG_TDI_write(1);
+
+  dap_resp_add_byte(DAP_OK);
+  dap_resp_add_word(data);
+#endif
+}
+
+#ifdef DAP_CONFIG_ENABLE_CLOCK_DISCOVERY
+//-----------------------------------------------------------------------------
+static void dap_clock_recover(void)
+{
+  uint32_t data = DP_ABORT_CLEAR_ALL;
+
+  dap_setup_clock(dap_clock_tier_freq(DAP_CLOCK_TIER_COUNT-1));
+  dap_swd_reset_line(NULL);
+  dap_swd_operation(SWD_DP_W_ABORT, &data);
+}
+
+//-----------------------------------------------------------------------------
+static bool dap_clock_check(uint32_t select, uint32_t idcode, uint32_t tar_mask, int iterations)
+{
+  uint32_t data, pattern;
+
+  if (DAP_TRANSFER_OK != dap_transfer_word(SWD_DP_W_SELECT, &select))
+    return false;
+
+  for (int i = 0; i < iterations; i++)
+  {
+    if (DAP_TRANSFER_OK != dap_transfer_word(SWD_DP_R_IDCODE | DAP_TRANSFER_RnW, &data) ||
+        data != idcode)
+      return false;
+
+    // Loop a pattern through the TAR, this exercises both data directions
+    pattern = ((i & 1) ? 0xaaaaaaaa : 0x55555555) ^ (i * 0x9e3779b9);
+
+    if (DAP_TRANSFER_OK != dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_TAR, &pattern) ||
+        DAP_TRANSFER_OK != dap_transfer_word(DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | SWD_AP_TAR, NULL) ||
+        DAP_TRANSFER_OK != dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, &data) ||
+        ((data ^ pattern) & tar_mask))
+      return false;
+  }
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+static void dap_ex_discover_clock(void)
+{
+  uint32_t select = (uint32_t)dap_req_get_byte() << 24;
+  int iterations = dap_req_get_half();
+  int margin = dap_req_get_byte();
+  int freq = dap_clock_freq;
+  int lo = 0, hi = DAP_CLOCK_TIER_COUNT-1;
+  uint32_t idcode, tar, ones, zeros, tar_mask;
+#ifdef DAP_CONFIG_ENABLE_LINK_MONITOR
+  bool link_enabled = dap_link_enabled;
+#endif
+
+  if (DAP_PORT_SWD != dap_port || dap_buf_error)
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    return;
+  }
+
+#ifdef DAP_CONFIG_ENABLE_LINK_MONITOR
+  // Errors are expected here, they must not cause derating
+  dap_link_enabled = false;
+#endif
+
+  // Take the reference values at the slowest tier
+  dap_clock_recover();
+
+  ones  = 0xffffffff;
+  zeros = 0;
+
+  if (DAP_TRANSFER_OK != dap_swd_reset_line(&idcode) ||
+      DAP_TRANSFER_OK != dap_transfer_word(SWD_DP_W_SELECT, &select) ||
+      DAP_TRANSFER_OK != dap_transfer_word(DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | SWD_AP_TAR, NULL) ||
+      DAP_TRANSFER_OK != dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, &tar) ||
+      DAP_TRANSFER_OK != dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_TAR, &ones) ||
+      DAP_TRANSFER_OK != dap_transfer_word(DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | SWD_AP_TAR, NULL) ||
+      DAP_TRANSFER_OK != dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, &ones) ||
+      DAP_TRANSFER_OK != dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_TAR, &zeros) ||
+      DAP_TRANSFER_OK != dap_transfer_word(DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | SWD_AP_TAR, NULL) ||
+      DAP_TRANSFER_OK != dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, &zeros) ||
+      !dap_clock_check(select, idcode, ones & ~zeros, iterations))
+  {
+    dap_setup_clock(freq);
+#ifdef DAP_CONFIG_ENABLE_LINK_MONITOR
+    dap_link_enabled = link_enabled;
+#endif
+    dap_resp_add_byte(DAP_ERROR);
+    return;
+  }
+
+  // Only the bits implemented by the TAR are compared
+  tar_mask = ones & ~zeros;
+
+  // Find the fastest passing tier, assuming that all slower tiers pass as well
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+
+    dap_setup_clock(dap_clock_tier_freq(mid));
+
+    if (dap_clock_check(select, idcode, tar_mask, iterations))
+    {
+      hi = mid;
+    }
+    else
+    {
+      dap_clock_recover();
+      lo = mid + 1;
+    }
+  }
+
+  hi += margin;
+
+  if (hi > DAP_CLOCK_TIER_COUNT-1)
+    hi = DAP_CLOCK_TIER_COUNT-1;
+
+  dap_setup_clock(dap_clock_tier_freq(hi));
+  dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_TAR, &tar);
+
+#ifdef DAP_CONFIG_ENABLE_LINK_MONITOR
+  dap_link_enabled = link_enabled;
+  dap_link_freq = dap_clock_freq;
+  dap_link_clean = 0;
+#endif
+
+  dap_resp_add_byte(DAP_OK);
+  dap_resp_add_word(dap_clock_freq);
+}
+#endif // DAP_CONFIG_ENABLE_CLOCK_DISCOVERY
+
+#ifdef DAP_CONFIG_ENABLE_LINK_MONITOR
+//-----------------------------------------------------------------------------
+static void dap_ex_link_configure(void)
+{
+  bool enabled = dap_req_get_byte();
+  int window = dap_req_get_half();
+  int threshold = dap_req_get_half();
+  int clean_limit = dap_req_get_half();
+
+  if (dap_buf_error || 0 == window || 0 == threshold || 0 == clean_limit)
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    return;
+  }
+
+  if (dap_clock_freq != dap_link_freq)
+    dap_setup_clock(dap_link_freq);
+
+  dap_link_enabled      = enabled;
+  dap_link_window       = window;
+  dap_link_threshold    = threshold;
+  dap_link_clean_limit  = clean_limit;
+  dap_link_count        = 0;
+  dap_link_errors       = 0;
+  dap_link_clean        = 0;
+  dap_link_total_errors = 0;
+  dap_link_derate_count = 0;
+  dap_link_uprate_count = 0;
+
+  dap_resp_add_byte(DAP_OK);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_ex_link_status(void)
+{
+  dap_resp_add_byte(dap_link_enabled);
+  dap_resp_add_word(dap_clock_freq);
+  dap_resp_add_word(dap_link_freq);
+  dap_resp_add_word(dap_link_total_errors);
+  dap_resp_add_word(dap_link_derate_count);
+  dap_resp_add_word(dap_link_uprate_count);
+}
+#endif // DAP_CONFIG_ENABLE_LINK_MONITOR
+
+#ifdef DAP_CONFIG_ENABLE_GANG
+//-----------------------------------------------------------------------------
+static void dap_ex_gang_configure(void)
+{
+  uint32_t lanes = dap_req_get_byte();
+
+  if (dap_buf_error || (lanes & ~DAP_GANG_ALL_LANES) || (lanes && DAP_PORT_SWD != dap_port))
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    dap_resp_add_byte(DAP_CONFIG_GANG_COUNT);
+    return;
+  }
+
+  dap_gang_lanes = lanes;
+
+  DAP_CONFIG_GANG_SWDIO_write(lanes);
+  DAP_CONFIG_GANG_SWDIO_out(lanes);
+  DAP_CONFIG_GANG_SWDIO_in(DAP_GANG_ALL_LANES & ~lanes);
+
+  dap_resp_add_byte(DAP_OK);
+  dap_resp_add_byte(DAP_CONFIG_GANG_COUNT);
+}
+
+//-----------------------------------------------------------------------------
+static int dap_gang_resp_init(void)
+{
+  int index = dap_resp_ptr;
+
+  dap_gang_active = dap_gang_lanes;
+
+  // Without configured lanes nothing is transferred, report that explicitly
+  if (0 == dap_gang_lanes)
+    dap_resp_add_byte(DAP_ERROR);
+
+  for (int lane = 0; lane < DAP_CONFIG_GANG_COUNT; lane++)
+  {
+    dap_gang_ack[lane] = DAP_TRANSFER_OK;
+
+    if (dap_gang_lanes & (1ul << lane))
+      dap_resp_add_byte(DAP_TRANSFER_INVALID);
+  }
+
+  return index;
+}
+
+//-----------------------------------------------------------------------------
+static void dap_gang_resp_set_acks(int index)
+{
+  for (int lane = 0; lane < DAP_CONFIG_GANG_COUNT; lane++)
+  {
+    if (dap_gang_lanes & (1ul << lane))
+      dap_resp_set_byte(index++, dap_gang_ack[lane]);
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void dap_gang_resp_add_data(uint32_t *data)
+{
+  for (int lane = 0; lane < DAP_CONFIG_GANG_COUNT; lane++)
+  {
+    uint32_t mask = 1ul << lane;
+
+    if (dap_gang_lanes & mask)
+      dap_resp_add_word((dap_gang_active & mask) ? data[lane] : 0);
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void dap_ex_gang_transfer(void)
+{
+  int req_count, resp_count, request, index;
+  bool posted_read, verify_write;
+  uint32_t data[DAP_CONFIG_GANG_COUNT];
+
+  dap_resp_add_byte(0); // Count
+  index = dap_gang_resp_init();
+
+  req_count  = dap_req_get_byte();
+  resp_count = 0;
+
+  posted_read = false;
+  verify_write = false;
+
+  for (; req_count && dap_gang_active && !dap_abort && !dap_buf_error; req_count--, resp_count++)
+  {
+    request = dap_req_get_byte();
+    verify_write = false;
+
+    if (posted_read)
+    {
+      if (dap_needs_posted_read(request))
+      {
+        dap_gang_transfer_word(request, dap_gang_active, data);
+      }
+      else
+      {
+        dap_gang_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, dap_gang_active, data);
+        posted_read = false;
+      }
+
+      // A transfer that failed on all lanes is not counted, same as in dap_transfer()
+      if (0 == dap_gang_active)
+        break;
+
+      dap_gang_resp_add_data(data);
+
+      if (posted_read)
+        continue;
+    }
+
+    if (request & DAP_TRANSFER_RnW)
+    {
+      if (request & DAP_TRANSFER_MATCH_VALUE)
+      {
+        uint32_t match_value = dap_req_get_word();
+        uint32_t pending;
+
+        if (dap_needs_posted_read(request))
+          dap_gang_transfer_word(request, dap_gang_active, data);
+
+        pending = dap_gang_active;
+
+        for (int i = 0; i < dap_match_retry_count && pending && !dap_abort; i++)
+        {
+          uint32_t done = dap_gang_transfer_word(request, pending, data);
+
+          for (int lane = 0; lane < DAP_CONFIG_GANG_COUNT; lane++)
+          {
+            if ((done & (1ul << lane)) && (data[lane] & dap_match_mask) == match_value)
+              pending &= ~(1ul << lane);
+          }
+
+          pending &= dap_gang_active;
+        }
+
+        for (int lane = 0; lane < DAP_CONFIG_GANG_COUNT; lane++)
+        {
+          if (pending & (1ul << lane))
+            dap_gang_ack[lane] |= DAP_TRANSFER_MISMATCH;
+        }
+
+        dap_gang_active &= ~pending;
+
+        if (0 == dap_gang_active)
+          break;
+      }
+      else if (dap_needs_posted_read(request))
+      {
+        dap_gang_transfer_word(request, dap_gang_active, data);
+
+        if (0 == dap_gang_active)
+          break;
+
+        posted_read = true;
+      }
+      else
+      {
+        dap_gang_transfer_word(request, dap_gang_active, data);
+
+        if (0 == dap_gang_active)
+          break;
+
+        dap_gang_resp_add_data(data);
+      }
+    }
+    else // Write
+    {
+      data[0] = dap_req_get_word();
+
+      if (request & DAP_TRANSFER_MATCH_MASK)
+      {
+        dap_match_mask = data[0];
+      }
+      else
+      {
+        dap_gang_transfer_word(request, dap_gang_active, data);
+
+        if (0 == dap_gang_active)
+          break;
+
+        verify_write = true;
+      }
+    }
+  }
+
+  if (dap_gang_active)
+  {
+    if (posted_read)
+    {
+      dap_gang_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, dap_gang_active, data);
+      dap_gang_resp_add_data(data);
+    }
+    else if (verify_write)
+    {
+      dap_gang_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, dap_gang_active, data);
+    }
+  }
+
+  dap_resp_set_byte(1, resp_count);
+  dap_gang_resp_set_acks(index);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_ex_gang_transfer_block(void)
+{
+  int req_count, resp_count, request, index;
+  uint32_t data[DAP_CONFIG_GANG_COUNT];
+
+  dap_resp_add_byte(0); // Count
+  dap_resp_add_byte(0); // Count
+  index = dap_gang_resp_init();
+
+  req_count  = dap_req_get_half();
+  resp_count = 0;
+
+  if (0 == req_count)
+  {
+    dap_gang_resp_set_acks(index);
+    return;
+  }
+
+  request = dap_req_get_byte();
+
+  if (request & DAP_TRANSFER_RnW)
+  {
+    bool needs_posted = dap_needs_posted_read(request);
+    int transfers = needs_posted ? (req_count + 1) : req_count;
+
+    for (int i = 0; i < transfers && dap_gang_active && !dap_abort && !dap_buf_error; i++)
+    {
+      if (i == req_count)
+        request = SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW;
+
+      dap_gang_transfer_word(request, dap_gang_active, data);
+
+      if (0 == dap_gang_active)
+        break;
+
+      if (needs_posted && i == 0)
+        continue;
+
+      dap_gang_resp_add_data(data);
+      resp_count++;
+    }
+  }
+  else // Write
+  {
+    for (int i = 0; i < req_count && dap_gang_active && !dap_abort; i++)
+    {
+      data[0] = dap_req_get_word();
+
+      dap_gang_transfer_word(request, dap_gang_active, data);
+
+      if (0 == dap_gang_active)
+        break;
+
+      resp_count++;
+    }
+
+    dap_gang_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, dap_gang_active, data);
+  }
+
+  dap_resp_set_byte(1, resp_count);
+  dap_resp_set_byte(2, resp_count >> 8);
+  dap_gang_resp_set_acks(index);
+}
+#endif // DAP_CONFIG_ENABLE_GANG
+
+#ifdef DAP_CONFIG_ENABLE_MULTIDROP
+//-----------------------------------------------------------------------------
+static void dap_ex_multidrop_configure(void)
+{
+  int count = dap_req_get_byte();
+
+  if (count > DAP_CONFIG_MULTIDROP_COUNT)
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    dap_resp_add_byte(DAP_CONFIG_MULTIDROP_COUNT);
+    return;
+  }
+
+  for (int i = 0; i < count; i++)
+    dap_multidrop_targetsel[i] = dap_req_get_word();
+
+  if (dap_buf_error)
+    count = 0;
+
+  dap_multidrop_count = count;
+  dap_multidrop_index = -1;
+
+  dap_resp_add_byte(dap_buf_error ? DAP_ERROR : DAP_OK);
+  dap_resp_add_byte(DAP_CONFIG_MULTIDROP_COUNT);
+}
+#endif // DAP_CONFIG_ENABLE_MULTIDROP
+
+#ifdef DAP_CONFIG_ENABLE_ORUN_WRITE
+//-----------------------------------------------------------------------------
+static void dap_ex_orun_write(void)
+{
+  dap_orun_write_enabled = (0 != dap_req_get_byte());
+
+  dap_resp_add_byte(DAP_OK);
+}
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_AUTO_RECOVERY
+//-----------------------------------------------------------------------------
+static void dap_ex_recovery_configure(void)
+{
+  int enable = dap_req_get_byte();
+
+  if (dap_buf_error)
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    return;
+  }
+
+  if (0xff != enable)
+    dap_recovery_enabled = (0 != enable);
+
+  // The count is free running, the host compares it with a previous value
+  dap_resp_add_byte(DAP_OK);
+  dap_resp_add_word(dap_recovery_count);
+}
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_ADAPTIVE_WAIT
+//-----------------------------------------------------------------------------
+static void dap_ex_adaptive_wait(void)
+{
+  bool enable = (0 != dap_req_get_byte());
+
+  if (dap_buf_error)
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    return;
+  }
+
+  if (enable && !dap_wait_enabled)
+  {
+    for (int i = 0; i < DAP_CONFIG_ADAPTIVE_WAIT_AP_COUNT; i++)
+      dap_wait_idle[i] = 0;
+
+    dap_wait_clean = 0;
+  }
+
+  dap_wait_enabled = enable;
+
+  dap_resp_add_byte(DAP_OK);
+  dap_resp_add_byte(DAP_CONFIG_ADAPTIVE_WAIT_AP_COUNT);
+
+  for (int i = 0; i < DAP_CONFIG_ADAPTIVE_WAIT_AP_COUNT; i++)
+    dap_resp_add_byte(dap_wait_idle[i]);
+}
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_MATCH_TIMEOUT
+//-----------------------------------------------------------------------------
+static void dap_ex_match_timeout(void)
+{
+  uint32_t timeout = dap_req_get_word();
+  int interval = dap_req_get_half();
+
+  if (dap_buf_error)
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    return;
+  }
+
+  if (timeout > DAP_MATCH_TIMEOUT_MAX)
+    timeout = DAP_MATCH_TIMEOUT_MAX;
+
+  dap_match_timeout  = timeout;
+  dap_match_interval = interval;
+
+  dap_resp_add_byte(DAP_OK);
+}
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+//-----------------------------------------------------------------------------
+static void dap_ex_write_cache(void)
+{
+  dap_cache_enabled = (0 != dap_req_get_byte());
+  dap_cache_invalidate();
+
+  dap_resp_add_byte(DAP_OK);
+}
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_PREFETCH
+//-----------------------------------------------------------------------------
+static void dap_ex_prefetch_configure(void)
+{
+  int count = dap_req_get_byte();
+
+  dap_prefetch_invalidate();
+
+  if (count > DAP_CONFIG_PREFETCH_RANGE_COUNT)
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    dap_resp_add_byte(DAP_CONFIG_PREFETCH_RANGE_COUNT);
+    return;
+  }
+
+  for (int i = 0; i < count; i++)
+  {
+    dap_prefetch_range_start[i] = dap_req_get_word();
+    dap_prefetch_range_end[i] = dap_prefetch_range_start[i] + dap_req_get_word();
+  }
+
+  dap_prefetch_range_count = dap_buf_error ? 0 : count;
+
+  dap_resp_add_byte(dap_buf_error ? DAP_ERROR : DAP_OK);
+  dap_resp_add_byte(DAP_CONFIG_PREFETCH_RANGE_COUNT);
+}
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_MEM_BLOCK
+//-----------------------------------------------------------------------------
+static int dap_mem_csw_setup(int size, uint32_t *csw, bool *saved, bool *packed)
+{
+  uint32_t data;
+  int ack;
+
+  ack = dap_transfer_word(DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | SWD_AP_CSW, NULL);
+
+  if (DAP_TRANSFER_OK == ack)
+    ack = dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, csw);
+
+  if (DAP_TRANSFER_OK != ack)
+    return ack;
+
+  *saved = true;
+
+  data = (*csw & ~(AP_CSW_SIZE_MASK | AP_CSW_ADDRINC_MASK)) | size | AP_CSW_ADDRINC_PACKED;
+  ack = dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_CSW, &data);
+
+  // Packed transfers are optional, unsupported AddrInc values read back differently
+  if (DAP_TRANSFER_OK == ack)
+    ack = dap_transfer_word(DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | SWD_AP_CSW, NULL);
+
+  if (DAP_TRANSFER_OK == ack)
+    ack = dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, &data);
+
+  *packed = (AP_CSW_ADDRINC_PACKED == (data & AP_CSW_ADDRINC_MASK));
+
+  if (DAP_TRANSFER_OK == ack && !*packed)
+  {
+    data = (*csw & ~(AP_CSW_SIZE_MASK | AP_CSW_ADDRINC_MASK)) | size | AP_CSW_ADDRINC_SINGLE;
+    ack = dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_CSW, &data);
+  }
+
+  return ack;
+}
+
+//-----------------------------------------------------------------------------
+static int dap_mem_block_run(bool read, uint32_t addr, int count, int size, bool full, int *resp_count)
+{
+  int req = DAP_TRANSFER_APnDP | SWD_AP_DRW | (read ? DAP_TRANSFER_RnW : 0);
+  int bytes = 1 << size;
+  int transfers = read ? (count + 1) : count;
+  int ack = DAP_TRANSFER_OK;
+  uint32_t data;
+
+  // Full transfers move a whole word, otherwise one element is in its byte lane
+  for (int i = 0; i < transfers; i++)
+  {
+    if (read && i == count)
+      req = SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW;
+
+    if (!read && full)
+    {
+      data = dap_req_get_word();
+    }
+    else if (!read)
+    {
+      data = 0;
+
+      for (int j = 0; j < bytes; j++)
+        data |= (uint32_t)dap_req_get_byte() << (j * 8);
+
+      data <<= (addr & 3) * 8;
+    }
+
+    ack = dap_transfer_word(req, &data);
+
+    if (DAP_TRANSFER_OK != ack)
+      break;
+
+    // DRW reads are posted, data for the previous element comes back
+    if (read && i == 0)
+      continue;
+
+    if (read && full)
+    {
+      dap_resp_add_word(data);
+    }
+    else if (read)
+    {
+      data >>= (addr & 3) * 8;
+
+      for (int j = 0; j < bytes; j++)
+        dap_resp_add_byte(data >> (j * 8));
+    }
+
+    *resp_count += full ? (4 >> size) : 1;
+    addr += full ? 4 : bytes;
+
+    if (dap_buf_error)
+      break;
+  }
+
+  return ack;
+}
+
+//-----------------------------------------------------------------------------
+static int dap_mem_transfer(bool read, uint32_t addr, int req_count, int size, int *resp_count)
+{
+  uint32_t data, csw = 0;
+  bool saved = false, packed = true, full;
+  int ack;
+
+  // Word transfers use CSW configured by the host, smaller sizes are packed
+  // when the MEM-AP supports it
+  if (AP_CSW_SIZE_WORD == size)
+    ack = DAP_TRANSFER_OK;
+  else
+    ack = dap_mem_csw_setup(size, &csw, &saved, &packed);
+
+  full = packed;
+
+  while (DAP_TRANSFER_OK == ack && *resp_count < req_count && !dap_abort && !dap_buf_error)
+  {
+    // Split the transfer at the TAR wrap boundaries
+    int count = (DAP_TAR_WRAP_MASK + 1 - (addr & DAP_TAR_WRAP_MASK)) >> size;
+
+    if (count > (req_count - *resp_count))
+      count = req_count - *resp_count;
+
+    data = addr;
+
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+    // TAR is already there when this block continues the previous one
+    if (dap_cache_hit(DAP_TRANSFER_APnDP | SWD_AP_TAR, data))
+      ack = DAP_TRANSFER_OK;
+    else
+#endif
+    ack = dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_TAR, &data);
+
+    // Unaligned head and short tail go as single elements, the rest as full words
+    while (DAP_TRANSFER_OK == ack && count > 0 && !dap_buf_error)
+    {
+      int elements, transfers;
+      bool run_full;
+
+      if (packed && 0 == (addr & 3) && (count << size) >= 4)
+      {
+        run_full = true;
+        transfers = (count << size) / 4;
+        elements = transfers * (4 >> size);
+      }
+      else
+      {
+        run_full = false;
+        transfers = (packed && (addr & 3)) ? (int)((4 - (addr & 3)) >> size) : count;
+
+        if (transfers > count)
+          transfers = count;
+
+        elements = transfers;
+      }
+
+      if (AP_CSW_SIZE_WORD != size && run_full != full)
+      {
+        data = (csw & ~(AP_CSW_SIZE_MASK | AP_CSW_ADDRINC_MASK)) | size |
+            (run_full ? AP_CSW_ADDRINC_PACKED : AP_CSW_ADDRINC_SINGLE);
+        ack = dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_CSW, &data);
+        full = run_full;
+
+        if (DAP_TRANSFER_OK != ack)
+          break;
+      }
+
+      ack = dap_mem_block_run(read, addr, transfers, size, run_full, resp_count);
+
+      addr  += elements << size;
+      count -= elements;
+    }
+  }
+
+  // The host does not expect CSW to change, restore it even after an error.
+  // This may fail on its own, the original error is reported in that case.
+  if (saved)
+  {
+    int status = dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_CSW, &csw);
+
+    if (DAP_TRANSFER_OK == ack)
+      ack = status;
+  }
+
+  if (DAP_TRANSFER_OK == ack && !read)
+    ack = dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, NULL);
+
+  return ack;
+}
+
+//-----------------------------------------------------------------------------
+static bool dap_mem_request_valid(uint32_t addr, int size)
+{
+  return size <= AP_CSW_SIZE_WORD && 0 == (addr & ((1 << size) - 1));
+}
+
+//-----------------------------------------------------------------------------
+static void dap_ex_mem_block(void)
+{
+  int req_count, resp_count, request, size, ack;
+  uint32_t addr;
+
+  dap_resp_add_byte(0); // Count
+  dap_resp_add_byte(0); // Count
+  dap_resp_add_byte(DAP_TRANSFER_INVALID);
+
+  if (!dap_select_device(dap_req_get_byte()))
+    return;
+
+  request    = dap_req_get_byte();
+  addr       = dap_req_get_word();
+  req_count  = dap_req_get_half();
+  resp_count = 0;
+  size       = (request & DAP_MEM_BLOCK_SIZE_MASK) >> DAP_MEM_BLOCK_SIZE_SHIFT;
+
+  if (0 == req_count || !dap_mem_request_valid(addr, size) || dap_buf_error)
+    return;
+
+  ack = dap_mem_transfer(request & DAP_TRANSFER_RnW, addr, req_count, size, &resp_count);
+
+#ifdef DAP_CONFIG_ENABLE_AUTO_RECOVERY
+  dap_recover(ack);
+#endif
+
+  dap_resp_set_byte(1, resp_count);
+  dap_resp_set_byte(2, resp_count >> 8);
+  dap_resp_set_byte(3, ack);
+}
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_SCATTER
+//-----------------------------------------------------------------------------
+static void dap_ex_scatter(void)
+{
+  int req_count, resp_count, request, size, count, done, ack, start;
+  uint32_t addr;
+
+  dap_resp_add_byte(0); // Count
+  dap_resp_add_byte(DAP_TRANSFER_INVALID);
+
+  if (!dap_select_device(dap_req_get_byte()))
+    return;
+
+  count = dap_req_get_byte();
+  start = dap_resp_ptr;
+  ack   = DAP_TRANSFER_OK;
+
+  for (done = 0; done < count && !dap_abort; done++)
+  {
+    request    = dap_req_get_byte();
+    addr       = dap_req_get_word();
+    req_count  = dap_req_get_half();
+    resp_count = 0;
+    size       = (request & DAP_MEM_BLOCK_SIZE_MASK) >> DAP_MEM_BLOCK_SIZE_SHIFT;
+    start      = dap_resp_ptr;
+
+    if (0 == req_count || !dap_mem_request_valid(addr, size) || dap_buf_error)
+    {
+      ack = DAP_TRANSFER_INVALID;
+      break;
+    }
+
+    ack = dap_mem_transfer(request & DAP_TRANSFER_RnW, addr, req_count, size, &resp_count);
+
+    // The response has no element counts, so a descriptor is either complete or
+    // fails without data. Running out of response space is reported as invalid.
+    if (DAP_TRANSFER_OK == ack && resp_count < req_count)
+      ack = DAP_TRANSFER_INVALID;
+
+    if (DAP_TRANSFER_OK != ack)
+    {
+      dap_resp_ptr = start;
+      break;
+    }
+  }
+
+#ifdef DAP_CONFIG_ENABLE_AUTO_RECOVERY
+  dap_recover(ack);
+#endif
+
+  dap_resp_set_byte(1, done);
+  dap_resp_set_byte(2, ack);
+}
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_STREAM
+//-----------------------------------------------------------------------------
+static void dap_stream_check(int cmd)
+{
+  // Any unrelated command ends the stream
+  if (ID_DAP_EX_STREAM_CREDIT != cmd && ID_DAP_EX_STREAM_DATA != cmd)
+    dap_stream_active = false;
+}
+
+//-----------------------------------------------------------------------------
+static int dap_stream_read_packet(void)
+{
+  int count, resp_count = 0, ack;
+  uint32_t remaining = dap_stream_count - dap_stream_pos;
+
+  dap_resp_add_byte(ID_DAP_EX_STREAM);
+  dap_resp_add_byte(0); // Count
+  dap_resp_add_byte(0); // Count
+  dap_resp_add_byte(DAP_TRANSFER_INVALID);
+
+  count = (dap_resp_size - dap_resp_ptr) >> dap_stream_size;
+
+  if ((uint32_t)count > remaining)
+    count = remaining;
+
+  ack = dap_mem_transfer(true, dap_stream_addr, count, dap_stream_size, &resp_count);
+
+#ifdef DAP_CONFIG_ENABLE_AUTO_RECOVERY
+  dap_recover(ack);
+#endif
+
+  dap_stream_addr += resp_count << dap_stream_size;
+  dap_stream_pos  += resp_count;
+  dap_stream_done += resp_count;
+  dap_stream_credits--;
+
+  if (DAP_TRANSFER_OK != ack || dap_abort || dap_stream_pos == dap_stream_count)
+    dap_stream_active = false;
+
+  dap_resp_set_byte(1, resp_count);
+  dap_resp_set_byte(2, resp_count >> 8);
+  dap_resp_set_byte(3, ack);
+
+  return dap_resp_ptr;
+}
+
+//-----------------------------------------------------------------------------
+static void dap_ex_stream(void)
+{
+  int request, size;
+  uint32_t addr, count;
+
+  if (!dap_select_device(dap_req_get_byte()))
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    return;
+  }
+
+  request = dap_req_get_byte();
+  addr    = dap_req_get_word();
+  count   = dap_req_get_word();
+  dap_stream_credits = dap_req_get_byte();
+  size    = (request & DAP_MEM_BLOCK_SIZE_MASK) >> DAP_MEM_BLOCK_SIZE_SHIFT;
+
+  if (0 == count || !dap_mem_request_valid(addr, size) || dap_buf_error)
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    return;
+  }
+
+  dap_stream_active = true;
+  dap_stream_read   = (request & DAP_TRANSFER_RnW);
+  dap_stream_size   = size;
+  dap_stream_addr   = addr;
+  dap_stream_count  = count;
+  dap_stream_pos    = 0;
+  dap_stream_done   = 0;
+  dap_stream_ack    = DAP_TRANSFER_OK;
+
+  dap_resp_add_byte(DAP_OK);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_ex_stream_credit(void)
+{
+  int credits = dap_req_get_byte();
+
+  if (!dap_stream_active || !dap_stream_read || dap_buf_error)
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    return;
+  }
+
+  dap_stream_credits += credits;
+
+  // Credits are not acknowledged, the data packets follow
+  dap_resp_ptr = 0;
+}
+
+//-----------------------------------------------------------------------------
+static void dap_ex_stream_data(void)
+{
+  int count = dap_req_get_half();
+  int resp_count = 0, ack;
+
+  if (!dap_stream_active || dap_stream_read || dap_buf_error ||
+      (uint32_t)count > (dap_stream_count - dap_stream_pos) ||
+      (dap_req_size - dap_req_ptr) < (count << dap_stream_size))
+  {
+    dap_stream_active = false;
+    dap_stream_ack = DAP_TRANSFER_INVALID;
+  }
+  else if (DAP_TRANSFER_OK == dap_stream_ack)
+  {
+    ack = dap_mem_transfer(false, dap_stream_addr, count, dap_stream_size, &resp_count);
+
+#ifdef DAP_CONFIG_ENABLE_AUTO_RECOVERY
+    dap_recover(ack);
+#endif
+
+    dap_stream_addr += resp_count << dap_stream_size;
+    dap_stream_done += resp_count;
+    dap_stream_ack   = (DAP_TRANSFER_OK == ack && dap_abort) ? DAP_TRANSFER_INVALID : ack;
+  }
+
+  // Data after an error is discarded, the result is reported once the
+  // host has sent all of it
+  dap_stream_pos += count;
+
+  if (dap_stream_active && dap_stream_pos < dap_stream_count)
+  {
+    dap_resp_ptr = 0;
+    return;
+  }
+
+  dap_stream_active = false;
+
+  dap_resp_add_word(dap_stream_done);
+  dap_resp_add_byte(dap_stream_ack);
+}
+#endif // DAP_CONFIG_ENABLE_STREAM
+
+#if defined(DAP_CONFIG_ENABLE_SAMPLING) || defined(DAP_CONFIG_ENABLE_WATCH) || \
+    defined(DAP_CONFIG_ENABLE_PCSR) || defined(DAP_CONFIG_ENABLE_RTT) || \
+    defined(DAP_CONFIG_ENABLE_SEMIHOSTING)
+//-----------------------------------------------------------------------------
+static bool dap_background_read_ready(void)
+{
+  // DP SELECT can only be restored if its value is known
+  if (DAP_PORT_SWD != dap_port || !dap_cache_enabled || !dap_cache_select_valid)
+    return false;
+
+#ifdef DAP_CONFIG_ENABLE_GANG
+  if (dap_gang_lanes)
+    return false;
+#endif
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+static int dap_background_begin(uint32_t ap_select, int addrinc, dap_background_state_t *state)
+{
+  uint32_t data;
+  int ack;
+
+#ifdef DAP_CONFIG_ENABLE_READ_PIPELINE
+  dap_pipeline_close();
+#endif
+
+  state->select = dap_cache_select;
+  state->saved = false;
+  state->clean = false;
+
+  if (dap_cache_hit(SWD_DP_W_SELECT, ap_select))
+    ack = DAP_TRANSFER_OK;
+  else
+    ack = dap_transfer_word(SWD_DP_W_SELECT, &ap_select);
+
+  // Errors already reported by the target belong to the host, skip this cycle
+  if (DAP_TRANSFER_OK == ack)
+    ack = dap_read_ctrl_stat(&data);
+
+  if (DAP_TRANSFER_OK == ack && (data & DP_CST_ERRORS))
+    ack = DAP_TRANSFER_FAULT;
+  else if (DAP_TRANSFER_OK == ack)
+    state->clean = true;
+
+  // Save the state of the AP, the host does not expect it to change
+  if (DAP_TRANSFER_OK == ack)
+    ack = dap_transfer_word(DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | SWD_AP_CSW, NULL);
+
+  if (DAP_TRANSFER_OK == ack)
+    ack = dap_transfer_word(DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | SWD_AP_TAR, &state->csw);
+
+  if (DAP_TRANSFER_OK == ack)
+    ack = dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, &state->tar);
+
+  if (DAP_TRANSFER_OK == ack)
+  {
+    state->saved = true;
+    data = (state->csw & ~(AP_CSW_SIZE_MASK | AP_CSW_ADDRINC_MASK)) | AP_CSW_SIZE_WORD | addrinc;
+    ack = dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_CSW, &data);
+  }
+
+  return ack;
+}
+
+//-----------------------------------------------------------------------------
+static void dap_background_end(dap_background_state_t *state, int ack)
+{
+  // Errors caused by background reads must not be visible to the host. Only
+  // errors raised after the clean CTRL/STAT check in dap_background_begin() are cleared.
+  if (DAP_TRANSFER_OK != ack && state->clean)
+    dap_clear_errors();
+
+  if (state->saved)
+  {
+    ack = dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_CSW, &state->csw);
+
+    if (DAP_TRANSFER_OK == ack)
+      ack = dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_TAR, &state->tar);
+
+    if (DAP_TRANSFER_OK == ack)
+      ack = dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, NULL);
+
+    if (DAP_TRANSFER_OK != ack)
+      dap_clear_errors();
+  }
+
+  if (!dap_cache_hit(SWD_DP_W_SELECT, state->select))
+    dap_transfer_word(SWD_DP_W_SELECT, &state->select);
+}
+
+#if defined(DAP_CONFIG_ENABLE_SAMPLING) || defined(DAP_CONFIG_ENABLE_WATCH)
+//-----------------------------------------------------------------------------
+static int dap_background_read_words(uint32_t *addr, int count, uint32_t *values)
+{
+  int req, ack = DAP_TRANSFER_OK;
+  uint32_t data;
+
+  for (int i = 0, run; i < count && DAP_TRANSFER_OK == ack; i += run)
+  {
+    // Consecutive words within one TAR wrap block are read in a single run
+    for (run = 1; (i + run) < count; run++)
+    {
+      data = addr[i + run - 1] + 4;
+
+      if (data != addr[i + run] || 0 == (data & DAP_TAR_WRAP_MASK))
+        break;
+    }
+
+    data = addr[i];
+    ack = dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_TAR, &data);
+    req = DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | SWD_AP_DRW;
+
+    // DRW reads are posted, the last word comes from RDBUFF
+    for (int j = 0; j <= run && DAP_TRANSFER_OK == ack; j++)
+    {
+      if (j == run)
+        req = SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW;
+
+      ack = dap_transfer_word(req, &data);
+
+      if (j > 0)
+        values[i + j - 1] = data;
+    }
+  }
+
+  return ack;
+}
+
+//-----------------------------------------------------------------------------
+static int dap_background_read(uint32_t ap_select, uint32_t *addr, int count, uint32_t *values)
+{
+  dap_background_state_t state;
+  int ack;
+
+  for (int i = 0; i < count; i++)
+    values[i] = 0;
+
+  ack = dap_background_begin(ap_select, AP_CSW_ADDRINC_SINGLE, &state);
+
+  if (DAP_TRANSFER_OK == ack)
+    ack = dap_background_read_words(addr, count, values);
+
+  dap_background_end(&state, ack);
+
+  return ack;
+}
+#endif
+
+#if defined(DAP_CONFIG_ENABLE_RTT) || defined(DAP_CONFIG_ENABLE_SEMIHOSTING)
+//-----------------------------------------------------------------------------
+static int dap_background_read_block(uint32_t addr, int count, uint32_t *values)
+{
+  int req, ack = DAP_TRANSFER_OK;
+  uint32_t data;
+
+  for (int i = 0, run; i < count && DAP_TRANSFER_OK == ack; i += run, addr += run * 4)
+  {
+    // Split the read at the TAR wrap boundaries
+    run = (DAP_TAR_WRAP_MASK + 1 - (addr & DAP_TAR_WRAP_MASK)) / 4;
+
+    if (run > (count - i))
+      run = count - i;
+
+    data = addr;
+    ack = dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_TAR, &data);
+    req = DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | SWD_AP_DRW;
+
+    // DRW reads are posted, the last word comes from RDBUFF
+    for (int j = 0; j <= run && DAP_TRANSFER_OK == ack; j++)
+    {
+      if (j == run)
+        req = SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW;
+
+      ack = dap_transfer_word(req, &data);
+
+      if (j > 0)
+        values[i + j - 1] = data;
+    }
+  }
+
+  return ack;
+}
+
+//-----------------------------------------------------------------------------
+static int dap_background_write_word(uint32_t addr, uint32_t value)
+{
+  int ack;
+
+  ack = dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_TAR, &addr);
+
+  if (DAP_TRANSFER_OK == ack)
+    ack = dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_DRW, &value);
+
+  return ack;
+}
+
+//-----------------------------------------------------------------------------
+static int dap_background_write_bytes(uint32_t addr, uint8_t *data, int count, uint32_t csw)
+{
+  uint32_t value;
+  int ack;
+
+  // Bytes are written one at a time in their byte lanes
+  value = (csw & ~(AP_CSW_SIZE_MASK | AP_CSW_ADDRINC_MASK)) | AP_CSW_SIZE_BYTE | AP_CSW_ADDRINC_SINGLE;
+  ack = dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_CSW, &value);
+
+  for (int i = 0; i < count && DAP_TRANSFER_OK == ack; i++, addr++)
+  {
+    if (0 == i || 0 == (addr & DAP_TAR_WRAP_MASK))
+    {
+      value = addr;
+      ack = dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_TAR, &value);
+    }
+
+    value = (uint32_t)data[i] << ((addr & 3) * 8);
+
+    if (DAP_TRANSFER_OK == ack)
+      ack = dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_DRW, &value);
+  }
+
+  if (DAP_TRANSFER_OK == ack)
+  {
+    value = (csw & ~(AP_CSW_SIZE_MASK | AP_CSW_ADDRINC_MASK)) | AP_CSW_SIZE_WORD | AP_CSW_ADDRINC_SINGLE;
+    ack = dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_CSW, &value);
+  }
+
+  return ack;
+}
+#endif
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_SAMPLING
+//-----------------------------------------------------------------------------
+static void dap_sample_task(void)
+{
+  uint32_t now, *record;
+  int head;
+
+  if (0 == dap_sample_period || !dap_background_read_ready())
+    return;
+
+  now = DAP_CONFIG_TIMER_US();
+
+  if ((int32_t)(now - dap_sample_next) < 0)
+    return;
+
+  dap_sample_next += dap_sample_period;
+
+  // Missed ticks are skipped rather than sampled in a burst
+  if ((int32_t)(now - dap_sample_next) >= 0)
+    dap_sample_next = now + dap_sample_period;
+
+  head = (dap_sample_head + 1) % dap_sample_capacity;
+
+  if (head == dap_sample_tail)
+  {
+    if (dap_sample_dropped < 0xffff)
+      dap_sample_dropped++;
+    return;
+  }
+
+  record = &dap_sample_buf[dap_sample_head * dap_sample_record_size];
+  record[0] = now;
+  record[1] = dap_background_read(dap_sample_select, dap_sample_addr, dap_sample_count, &record[2]);
+
+  dap_sample_head = head;
+}
+
+//-----------------------------------------------------------------------------
+static void dap_sample_check(int cmd)
+{
+  // Any other command takes back the remaining credits
+  if (ID_DAP_EX_SAMPLE_DATA != cmd)
+    dap_sample_credits = 0;
+}
+
+//-----------------------------------------------------------------------------
+static int dap_sample_packet(void)
+{
+  int size = 5 + dap_sample_count * 4;
+  int count = 0;
+
+  dap_sample_credits--;
+
+  dap_resp_add_byte(ID_DAP_EX_SAMPLE_DATA);
+  dap_resp_add_byte(0); // Count
+  dap_resp_add_byte(dap_sample_dropped);
+  dap_resp_add_byte(dap_sample_dropped >> 8);
+
+  dap_sample_dropped = 0;
+
+  while (dap_sample_tail != dap_sample_head && count < 255 &&
+      (dap_resp_size - dap_resp_ptr) >= size)
+  {
+    uint32_t *record = &dap_sample_buf[dap_sample_tail * dap_sample_record_size];
+
+    dap_resp_add_word(record[0]);
+    dap_resp_add_byte(record[1]);
+
+    for (int i = 0; i < dap_sample_count; i++)
+      dap_resp_add_word(record[2 + i]);
+
+    dap_sample_tail = (dap_sample_tail + 1) % dap_sample_capacity;
+    count++;
+  }
+
+  dap_resp_set_byte(1, count);
+
+  return dap_resp_ptr;
+}
+
+//-----------------------------------------------------------------------------
+static void dap_ex_sample_configure(void)
+{
+  uint32_t select = dap_req_get_word();
+  uint32_t period = dap_req_get_word();
+  int count = dap_req_get_byte();
+
+  dap_sample_period = 0;
+
+  if (count > DAP_CONFIG_SAMPLE_COUNT)
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    dap_resp_add_byte(DAP_CONFIG_SAMPLE_COUNT);
+    return;
+  }
+
+  for (int i = 0; i < count; i++)
+  {
+    dap_sample_addr[i] = dap_req_get_word();
+
+    if (dap_sample_addr[i] & 3)
+      dap_buf_error = true;
+  }
+
+  dap_sample_record_size = 2 + count;
+  dap_sample_capacity = DAP_SAMPLE_BUF_WORDS / dap_sample_record_size;
+  dap_sample_head = 0;
+  dap_sample_tail = 0;
+  dap_sample_dropped = 0;
+  dap_sample_credits = 0;
+
+  if (dap_buf_error || dap_sample_capacity < 2)
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    dap_resp_add_byte(DAP_CONFIG_SAMPLE_COUNT);
+    return;
+  }
+
+  // CSW, TAR and DRW are in AP register bank 0
+  dap_sample_select = select & ~0xf0ul;
+  dap_sample_count  = count;
+  dap_sample_next   = DAP_CONFIG_TIMER_US();
+  dap_sample_period = count ? period : 0;
+
+  dap_resp_add_byte(DAP_OK);
+  dap_resp_add_byte(DAP_CONFIG_SAMPLE_COUNT);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_ex_sample_data(void)
+{
+  int credits = dap_req_get_byte();
+
+  if (0 == dap_sample_period || dap_buf_error)
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    return;
+  }
+
+  dap_sample_credits += credits;
+
+  // Credits are not acknowledged, the sample packets follow
+  dap_resp_ptr = 0;
+}
+#endif // DAP_CONFIG_ENABLE_SAMPLING
+
+#ifdef DAP_CONFIG_ENABLE_WATCH
+//-----------------------------------------------------------------------------
+static void dap_watch_task(void)
+{
+  uint32_t values[DAP_CONFIG_WATCH_COUNT];
+  uint32_t now;
+  int ack;
+
+  if (0 == dap_watch_count || !dap_background_read_ready())
+    return;
+
+  now = DAP_CONFIG_TIMER_US();
+
+  if (dap_watch_interval)
+  {
+    if ((int32_t)(now - dap_watch_next) < 0)
+      return;
+
+    dap_watch_next = now + dap_watch_interval;
+  }
+
+  ack = dap_background_read(dap_watch_select, dap_watch_addr, dap_watch_count, values);
+
+  if (ack != dap_watch_ack)
+  {
+    dap_watch_ack = ack;
+    dap_watch_pending = true;
+    dap_watch_time = now;
+  }
+
+  if (DAP_TRANSFER_OK != ack)
+    return;
+
+  // The first successful poll reports all values
+  for (int i = 0; i < dap_watch_count; i++)
+  {
+    if (dap_watch_valid && 0 == ((values[i] ^ dap_watch_value[i]) & dap_watch_mask[i]))
+      continue;
+
+    dap_watch_value[i] = values[i];
+    dap_watch_changed |= (1ul << i);
+    dap_watch_pending = true;
+    dap_watch_time = now;
+  }
+
+  dap_watch_valid = true;
+}
+
+//-----------------------------------------------------------------------------
+static void dap_watch_event(void)
+{
+  int space = (dap_resp_size - dap_resp_ptr - 9) / 4;
+  uint32_t mask = 0;
+
+  // Changes that do not fit into the response stay pending for the next event
+  for (int i = 0; i < dap_watch_count && space > 0; i++)
+  {
+    if (dap_watch_changed & (1ul << i))
+    {
+      mask |= (1ul << i);
+      space--;
+    }
+  }
+
+  dap_resp_add_word(mask);
+  dap_resp_add_byte(dap_watch_ack);
+  dap_resp_add_word(dap_watch_time);
+
+  for (int i = 0; i < dap_watch_count; i++)
+  {
+    if (mask & (1ul << i))
+      dap_resp_add_word(dap_watch_value[i]);
+  }
+
+  dap_watch_changed &= ~mask;
+  dap_watch_pending = (0 != dap_watch_changed);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_ex_watch_configure(void)
+{
+  uint32_t select = dap_req_get_word();
+  uint32_t interval = dap_req_get_word();
+  int count = dap_req_get_byte();
+
+  dap_watch_count = 0;
+
+  if (count > DAP_CONFIG_WATCH_COUNT)
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    dap_resp_add_byte(DAP_CONFIG_WATCH_COUNT);
+    return;
+  }
+
+  for (int i = 0; i < count; i++)
+  {
+    dap_watch_addr[i] = dap_req_get_word();
+    dap_watch_mask[i] = dap_req_get_word();
+
+    if (dap_watch_addr[i] & 3)
+      dap_buf_error = true;
+  }
+
+  if (dap_buf_error)
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    dap_resp_add_byte(DAP_CONFIG_WATCH_COUNT);
+    return;
+  }
+
+  // CSW, TAR and DRW are in AP register bank 0
+  dap_watch_select   = select & ~0xf0ul;
+  dap_watch_interval = interval;
+  dap_watch_next     = DAP_CONFIG_TIMER_US();
+  dap_watch_valid    = false;
+  dap_watch_pending  = false;
+  dap_watch_changed  = 0;
+  dap_watch_ack      = DAP_TRANSFER_OK;
+  dap_watch_count    = count;
+
+  dap_resp_add_byte(DAP_OK);
+  dap_resp_add_byte(DAP_CONFIG_WATCH_COUNT);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_ex_watch_event(void)
+{
+  dap_watch_event();
+}
+#endif // DAP_CONFIG_ENABLE_WATCH
+
+#ifdef DAP_CONFIG_ENABLE_PCSR
+//-----------------------------------------------------------------------------
+static void dap_pcsr_task(void)
+{
+  int req = DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | SWD_AP_DRW;
+  dap_background_state_t state;
+  uint32_t data, index, now;
+  int ack;
+
+  if (!dap_pcsr_enabled || !dap_background_read_ready())
+    return;
+
+  if (dap_pcsr_interval)
+  {
+    now = DAP_CONFIG_TIMER_US();
+
+    if ((int32_t)(now - dap_pcsr_next) < 0)
+      return;
+
+    dap_pcsr_next = now + dap_pcsr_interval;
+  }
+
+  ack = dap_background_begin(dap_pcsr_select, AP_CSW_ADDRINC_OFF, &state);
+
+  if (DAP_TRANSFER_OK == ack)
+  {
+    data = DAP_PCSR_ADDR;
+    ack = dap_transfer_word(DAP_TRANSFER_APnDP | SWD_AP_TAR, &data);
+  }
+
+  // DRW reads are posted, each read returns the sample taken by the previous one
+  for (int i = 0; i <= DAP_PCSR_CHUNK && DAP_TRANSFER_OK == ack; i++)
+  {
+    if (i == DAP_PCSR_CHUNK)
+      req = SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW;
+
+    ack = dap_transfer_word(req, &data);
+
+    if (0 == i || DAP_TRANSFER_OK != ack)
+      continue;
+
+    dap_pcsr_total++;
+
+    // PCSR reads as all ones while the core is halted
+    if (0xffffffff == data)
+    {
+      dap_pcsr_halted++;
+      continue;
+    }
+
+    index = (data - dap_pcsr_start) >> dap_pcsr_shift;
+
+    if (data < dap_pcsr_start || index >= (uint32_t)dap_pcsr_count)
+      dap_pcsr_outside++;
+    else
+      dap_pcsr_hist[index]++;
+  }
+
+  if (DAP_TRANSFER_OK != ack)
+    dap_pcsr_errors++;
+
+  dap_background_end(&state, ack);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_ex_pcsr_configure(void)
+{
+  uint32_t select = dap_req_get_word();
+  uint32_t interval = dap_req_get_word();
+  uint32_t start = dap_req_get_word();
+  int shift = dap_req_get_byte();
+  int count = dap_req_get_half();
+
+  if (dap_buf_error || count > DAP_CONFIG_PCSR_BUCKET_COUNT || shift > 31)
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    dap_resp_add_byte(DAP_CONFIG_PCSR_BUCKET_COUNT & 0xff);
+    dap_resp_add_byte(DAP_CONFIG_PCSR_BUCKET_COUNT >> 8);
+    return;
+  }
+
+  // Stopping keeps the histogram, so it can be read without it changing
+  if (count)
+  {
+    // CSW, TAR and DRW are in AP register bank 0
+    dap_pcsr_select   = select & ~0xf0ul;
+    dap_pcsr_interval = interval;
+    dap_pcsr_next     = DAP_CONFIG_TIMER_US();
+    dap_pcsr_start    = start;
+    dap_pcsr_shift    = shift;
+    dap_pcsr_count    = count;
+    dap_pcsr_total    = 0;
+    dap_pcsr_halted   = 0;
+    dap_pcsr_outside  = 0;
+    dap_pcsr_errors   = 0;
+
+    for (int i = 0; i < count; i++)
+      dap_pcsr_hist[i] = 0;
+  }
+
+  dap_pcsr_enabled = (count > 0);
+
+  dap_resp_add_byte(DAP_OK);
+  dap_resp_add_byte(DAP_CONFIG_PCSR_BUCKET_COUNT & 0xff);
+  dap_resp_add_byte(DAP_CONFIG_PCSR_BUCKET_COUNT >> 8);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_ex_pcsr_read(void)
+{
+  int first = dap_req_get_half();
+  int count = dap_req_get_half();
+  int space;
+
+  if (dap_buf_error || first > dap_pcsr_count)
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    return;
+  }
+
+  dap_resp_add_byte(DAP_OK);
+  dap_resp_add_word(dap_pcsr_total);
+  dap_resp_add_word(dap_pcsr_halted);
+  dap_resp_add_word(dap_pcsr_outside);
+  dap_resp_add_word(dap_pcsr_errors);
+
+  space = (dap_resp_size - dap_resp_ptr - 2) / 4;
+
+  if (count > (dap_pcsr_count - first))
+    count = dap_pcsr_count - first;
+
+  if (count > space)
+    count = space;
+
+  dap_resp_add_byte(count);
+  dap_resp_add_byte(count >> 8);
+
+  for (int i = 0; i < count; i++)
+    dap_resp_add_word(dap_pcsr_hist[first + i]);
+}
+#endif // DAP_CONFIG_ENABLE_PCSR
+
+#ifdef DAP_CONFIG_ENABLE_RTT
+//-----------------------------------------------------------------------------
+static int dap_rtt_search(void)
+{
+  uint32_t words[DAP_RTT_SCAN_CHUNK];
+  uint32_t max[2];
+  int count, ack;
+
+  count = (dap_rtt_end - dap_rtt_pos) / 4;
+
+  if (count > DAP_RTT_SCAN_CHUNK)
+    count = DAP_RTT_SCAN_CHUNK;
+
+  ack = dap_background_read_block(dap_rtt_pos, count, words);
+
+  if (DAP_TRANSFER_OK != ack)
+    return ack;
+
+  for (int i = 0; i <= (count - DAP_RTT_ID_SIZE); i++)
+  {
+    if (0 != memcmp(&words[i], dap_rtt_id, sizeof(dap_rtt_id)))
+      continue;
+
+    dap_rtt_cb = dap_rtt_pos + i * 4;
+
+    ack = dap_background_read_block(dap_rtt_cb + DAP_RTT_ID_SIZE * 4, 2, max);
+
+    if (DAP_TRANSFER_OK != ack)
+      return ack;
+
+    // The control block may be found before the target has initialized it
+    if ((int)max[0] <= dap_rtt_up_index || max[0] > 255 || max[1] > 255 ||
+        (DAP_RTT_NO_BUFFER != dap_rtt_down_index && (int)max[1] <= dap_rtt_down_index))
+      break;
+
+    dap_rtt_up_desc = dap_rtt_cb + DAP_RTT_CB_HEADER + dap_rtt_up_index * DAP_RTT_DESC_SIZE;
+    dap_rtt_down_desc = dap_rtt_cb + DAP_RTT_CB_HEADER + (max[0] + dap_rtt_down_index) * DAP_RTT_DESC_SIZE;
+    dap_rtt_state = DAP_RTT_RUNNING;
+
+    return ack;
+  }
+
+  // Chunks overlap, so that the ID crossing a chunk boundary is not missed
+  if ((dap_rtt_pos + count * 4) >= dap_rtt_end)
+    dap_rtt_pos = dap_rtt_start;
+  else
+    dap_rtt_pos += (count - DAP_RTT_ID_SIZE + 1) * 4;
+
+  return ack;
+}
+
+//-----------------------------------------------------------------------------
+static int dap_rtt_poll_up(void)
+{
+  uint32_t words[DAP_RTT_DATA_CHUNK + 1];
+  uint32_t desc[4], buf, size, wr_off, rd_off, addr;
+  int count, free, ack;
+
+  // Buffer pointer, size, write offset and read offset
+  ack = dap_background_read_block(dap_rtt_up_desc + 4, 4, desc);
+
+  if (DAP_TRANSFER_OK != ack)
+    return ack;
+
+  buf    = desc[0];
+  size   = desc[1];
+  wr_off = desc[2];
+  rd_off = desc[3];
+
+  // A corrupted descriptor means that the target was reset, search again
+  if (0 == size || wr_off >= size || rd_off >= size)
+  {
+    dap_rtt_state = DAP_RTT_SEARCHING;
+    dap_rtt_pos = dap_rtt_start;
+    return ack;
+  }
+
+  count = (wr_off >= rd_off) ? (int)(wr_off - rd_off) : (int)(size - rd_off);
+  free = (dap_rtt_up_tail - dap_rtt_up_head - 1 + DAP_CONFIG_RTT_BUF_SIZE) % DAP_CONFIG_RTT_BUF_SIZE;
+
+  if (count > free)
+    count = free;
+
+  if (count > (DAP_RTT_DATA_CHUNK * 4 - 3))
+    count = DAP_RTT_DATA_CHUNK * 4 - 3;
+
+  if (0 == count)
+    return ack;
+
+  addr = buf + rd_off;
+  ack = dap_background_read_block(addr & ~3ul, ((addr & 3) + count + 3) / 4, words);
+
+  if (DAP_TRANSFER_OK != ack)
+    return ack;
+
+  for (int i = 0; i < count; i++)
+  {
+    int offset = (addr & 3) + i;
+
+    dap_rtt_up_buf[dap_rtt_up_head] = words[offset / 4] >> ((offset % 4) * 8);
+    dap_rtt_up_head = (dap_rtt_up_head + 1) % DAP_CONFIG_RTT_BUF_SIZE;
+  }
+
+  return dap_background_write_word(dap_rtt_up_desc + DAP_RTT_DESC_RD_OFF, (rd_off + count) % size);
+}
+
+//-----------------------------------------------------------------------------
+static int dap_rtt_poll_down(uint32_t csw)
+{
+  uint8_t data[DAP_RTT_DATA_CHUNK * 4];
+  uint32_t desc[4], buf, size, wr_off, rd_off;
+  int count, ack;
+
+  if (DAP_RTT_NO_BUFFER == dap_rtt_down_index || dap_rtt_down_head == dap_rtt_down_tail)
+    return DAP_TRANSFER_OK;
+
+  ack = dap_background_read_block(dap_rtt_down_desc + 4, 4, desc);
+
+  if (DAP_TRANSFER_OK != ack)
+    return ack;
+
+  buf    = desc[0];
+  size   = desc[1];
+  wr_off = desc[2];
+  rd_off = desc[3];
+
+  if (0 == size || wr_off >= size || rd_off >= size)
+    return ack;
+
+  // One byte is always left free, so that a full buffer is not seen as empty
+  count = (rd_off > wr_off) ? (int)(rd_off - wr_off - 1) : (int)(size - wr_off - (0 == rd_off));
+
+  if (count > ((dap_rtt_down_head - dap_rtt_down_tail + DAP_CONFIG_RTT_BUF_SIZE) % DAP_CONFIG_RTT_BUF_SIZE))
+    count = (dap_rtt_down_head - dap_rtt_down_tail + DAP_CONFIG_RTT_BUF_SIZE) % DAP_CONFIG_RTT_BUF_SIZE;
+
+  if (count > (int)sizeof(data))
+    count = sizeof(data);
+
+  if (0 == count)
+    return ack;
+
+  for (int i = 0; i < count; i++)
+    data[i] = dap_rtt_down_buf[(dap_rtt_down_tail + i) % DAP_CONFIG_RTT_BUF_SIZE];
+
+  ack = dap_background_write_bytes(buf + wr_off, data, count, csw);
+
+  // The write offset is updated after the data, so the target never sees partial data
+  if (DAP_TRANSFER_OK == ack)
+    ack = dap_background_write_word(dap_rtt_down_desc + DAP_RTT_DESC_WR_OFF, (wr_off + count) % size);
+
+  if (DAP_TRANSFER_OK == ack)
+    dap_rtt_down_tail = (dap_rtt_down_tail + count) % DAP_CONFIG_RTT_BUF_SIZE;
+
+  return ack;
+}
+
+//-----------------------------------------------------------------------------
+static void dap_rtt_task(void)
+{
+  dap_background_state_t state;
+  uint32_t now;
+  int ack;
+
+  if (DAP_RTT_STOPPED == dap_rtt_state || !dap_background_read_ready())
+    return;
+
+  now = DAP_CONFIG_TIMER_US();
+
+  if ((int32_t)(now - dap_rtt_next) < 0)
+    return;
+
+  dap_rtt_next = now + dap_rtt_interval;
+
+  ack = dap_background_begin(dap_rtt_select, AP_CSW_ADDRINC_SINGLE, &state);
+
+  if (DAP_TRANSFER_OK == ack && DAP_RTT_SEARCHING == dap_rtt_state)
+    ack = dap_rtt_search();
+  else if (DAP_TRANSFER_OK == ack)
+    ack = dap_rtt_poll_up();
+
+  if (DAP_TRANSFER_OK == ack && DAP_RTT_RUNNING == dap_rtt_state)
+    ack = dap_rtt_poll_down(state.csw);
+
+  dap_background_end(&state, ack);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_ex_rtt_configure(void)
+{
+  uint32_t select = dap_req_get_word();
+  uint32_t start = dap_req_get_word();
+  uint32_t size = dap_req_get_word();
+  int up_index = dap_req_get_byte();
+  int down_index = dap_req_get_byte();
+  uint32_t interval = dap_req_get_word();
+
+  dap_rtt_state = DAP_RTT_STOPPED;
+
+  if (dap_buf_error || (start & 3) || (size && size < sizeof(dap_rtt_id)))
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    return;
+  }
+
+  // CSW, TAR and DRW are in AP register bank 0
+  dap_rtt_select     = select & ~0xf0ul;
+  dap_rtt_start      = start;
+  dap_rtt_end        = start + (size & ~3ul);
+  dap_rtt_pos        = start;
+  dap_rtt_cb         = 0;
+  dap_rtt_up_index   = up_index;
+  dap_rtt_down_index = down_index;
+  dap_rtt_interval   = interval;
+  dap_rtt_next       = DAP_CONFIG_TIMER_US();
+  dap_rtt_up_head    = 0;
+  dap_rtt_up_tail    = 0;
+  dap_rtt_down_head  = 0;
+  dap_rtt_down_tail  = 0;
+
+  if (size)
+    dap_rtt_state = DAP_RTT_SEARCHING;
+
+  dap_resp_add_byte(DAP_OK);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_ex_rtt_status(void)
+{
+  dap_resp_add_byte(dap_rtt_state);
+  dap_resp_add_word(dap_rtt_cb);
+}
+#endif // DAP_CONFIG_ENABLE_RTT
+
+#ifdef DAP_CONFIG_ENABLE_SEMIHOSTING
+//-----------------------------------------------------------------------------
+static int dap_semihost_reg_wait(void)
+{
+  uint32_t dhcsr = 0;
+  int ack = DAP_TRANSFER_OK;
+
+  for (int i = 0; i < DAP_SEMIHOST_REG_RETRY && DAP_TRANSFER_OK == ack; i++)
+  {
+    ack = dap_background_read_block(DAP_SEMIHOST_DHCSR, 1, &dhcsr);
+
+    if (DAP_TRANSFER_OK == ack && (dhcsr & DHCSR_S_REGRDY))
+      return ack;
+  }
+
+  return (DAP_TRANSFER_OK == ack) ? DAP_TRANSFER_ERROR : ack;
+}
+
+//-----------------------------------------------------------------------------
+static int dap_semihost_read_reg(int reg, uint32_t *value)
+{
+  int ack;
+
+  ack = dap_background_write_word(DAP_SEMIHOST_DCRSR, reg);
+
+  if (DAP_TRANSFER_OK == ack)
+    ack = dap_semihost_reg_wait();
+
+  if (DAP_TRANSFER_OK == ack)
+    ack = dap_background_read_block(DAP_SEMIHOST_DCRDR, 1, value);
+
+  return ack;
+}
+
+//-----------------------------------------------------------------------------
+static int dap_semihost_write_reg(int reg, uint32_t value)
+{
+  int ack;
+
+  ack = dap_background_write_word(DAP_SEMIHOST_DCRDR, value);
+
+  if (DAP_TRANSFER_OK == ack)
+    ack = dap_background_write_word(DAP_SEMIHOST_DCRSR, DCRSR_REGWnR | reg);
+
+  if (DAP_TRANSFER_OK == ack)
+    ack = dap_semihost_reg_wait();
+
+  return ack;
+}
+
+//-----------------------------------------------------------------------------
+static bool dap_semihost_console(uint32_t handle)
+{
+  // Handles 1 to 3 are returned for ":tt" by SEMIHOST_SYS_OPEN
+  return handle >= 1 && handle <= 3;
+}
+
+//-----------------------------------------------------------------------------
+static int dap_semihost_start(void)
+{
+  uint32_t op, param, args[3], name[2];
+  int ack;
+
+  ack = dap_semihost_read_reg(0, &op);
+
+  if (DAP_TRANSFER_OK == ack)
+    ack = dap_semihost_read_reg(1, &param);
+
+  if (DAP_TRANSFER_OK != ack)
+    return ack;
+
+  dap_semihost_op = op;
+  dap_semihost_addr = param;
+  dap_semihost_size = 0;
+  dap_semihost_result = 0;
+
+  // Operations that pass a parameter block
+  if (SEMIHOST_SYS_OPEN == op || SEMIHOST_SYS_CLOSE == op || SEMIHOST_SYS_WRITE == op ||
+      SEMIHOST_SYS_READ == op || SEMIHOST_SYS_ISTTY == op || SEMIHOST_SYS_HEAPINFO == op)
+  {
+    ack = dap_background_read_block(param, 3, args);
+
+    if (DAP_TRANSFER_OK != ack)
+      return ack;
+  }
+
+  switch (op)
+  {
+    case SEMIHOST_SYS_OPEN:
+    {
+      dap_semihost_result = 0xffffffff;
+
+      if (3 == args[2] && DAP_TRANSFER_OK == (ack = dap_background_read_block(args[0] & ~3ul, 2, name)))
+      {
+        uint8_t *str = (uint8_t *)name + (args[0] & 3);
+
+        // Modes "r", "w" and "a" select stdin, stdout and stderr
+        if (':' == str[0] && 't' == str[1] && 't' == str[2] && args[1] < 12)
+          dap_semihost_result = 1 + args[1] / 4;
+      }
+    } break;
+
+    case SEMIHOST_SYS_CLOSE:
+      dap_semihost_result = dap_semihost_console(args[0]) ? 0 : 0xffffffff;
+      break;
+
+    case SEMIHOST_SYS_ISTTY:
+      dap_semihost_result = dap_semihost_console(args[0]);
+      break;
+
+    case SEMIHOST_SYS_WRITEC:
+      dap_semihost_size = 1;
+      break;
+
+    case SEMIHOST_SYS_WRITE0:
+      dap_semihost_size = DAP_SEMIHOST_UNTIL_ZERO;
+      break;
+
+    case SEMIHOST_SYS_WRITE:
+    case SEMIHOST_SYS_READ:
+    {
+      // The result is the number of bytes that were not transferred
+      dap_semihost_addr = args[1];
+      dap_semihost_result = args[2];
+
+      if (dap_semihost_console(args[0]))
+        dap_semihost_size = args[2];
+    } break;
+
+    case SEMIHOST_SYS_READC:
+      dap_semihost_size = 1;
+      break;
+
+    case SEMIHOST_SYS_CLOCK:
+      dap_semihost_result = dap_semihost_elapsed / 10000;
+      break;
+
+    case SEMIHOST_SYS_TIME:
+      dap_semihost_result = dap_semihost_time + dap_semihost_elapsed / 1000000;
+      break;
+
+    case SEMIHOST_SYS_ERRNO:
+      break;
+
+    case SEMIHOST_SYS_HEAPINFO:
+    {
+      // Zeros tell the C library to use the default heap and stack
+      for (int i = 0; i < 4 && DAP_TRANSFER_OK == ack; i++)
+        ack = dap_background_write_word(args[0] + i * 4, 0);
+    } break;
+
+    case SEMIHOST_SYS_EXIT:
+    case SEMIHOST_SYS_EXIT_EXTENDED:
+      // The target stays halted
+      dap_semihost_ignore = true;
+      break;
+
+    default:
+      dap_semihost_result = 0xffffffff;
+      break;
+  }
+
+  return ack;
+}
+
+//-----------------------------------------------------------------------------
+static int dap_semihost_write_out(void)
+{
+  uint32_t words[DAP_SEMIHOST_CHUNK];
+  uint32_t addr = dap_semihost_addr;
+  int count, free, ack;
+
+  free = (dap_semihost_out_tail - dap_semihost_out_head - 1 + DAP_CONFIG_SEMIHOSTING_BUF_SIZE) %
+      DAP_CONFIG_SEMIHOSTING_BUF_SIZE;
+  count = DAP_SEMIHOST_CHUNK * 4 - (addr & 3);
+
+  if (count > free)
+    count = free;
+
+  if ((uint32_t)count > dap_semihost_size)
+    count = dap_semihost_size;
+
+  // Wait for the platform to take the data
+  if (0 == count)
+    return DAP_TRANSFER_OK;
+
+  ack = dap_background_read_block(addr & ~3ul, ((addr & 3) + count + 3) / 4, words);
+
+  if (DAP_TRANSFER_OK != ack)
+    return ack;
+
+  for (int i = 0; i < count; i++)
+  {
+    int offset = (addr & 3) + i;
+    uint8_t byte = words[offset / 4] >> ((offset % 4) * 8);
+
+    if (DAP_SEMIHOST_UNTIL_ZERO == dap_semihost_size && 0 == byte)
+    {
+      dap_semihost_size = 0;
+      return ack;
+    }
+
+    dap_semihost_out_buf[dap_semihost_out_head] = byte;
+    dap_semihost_out_head = (dap_semihost_out_head + 1) % DAP_CONFIG_SEMIHOSTING_BUF_SIZE;
+  }
+
+  dap_semihost_addr += count;
+
+  if (DAP_SEMIHOST_UNTIL_ZERO != dap_semihost_size)
+  {
+    dap_semihost_size -= count;
+
+    if (SEMIHOST_SYS_WRITE == dap_semihost_op)
+      dap_semihost_result -= count;
+  }
+
+  return ack;
+}
+
+//-----------------------------------------------------------------------------
+static int dap_semihost_read_in(uint32_t csw)
+{
+  uint8_t data[DAP_SEMIHOST_CHUNK * 4];
+  int count;
+
+  count = (dap_semihost_in_head - dap_semihost_in_tail + DAP_CONFIG_SEMIHOSTING_BUF_SIZE) %
+      DAP_CONFIG_SEMIHOSTING_BUF_SIZE;
+
+  // Wait for the platform to receive the data
+  if (0 == count)
+    return DAP_TRANSFER_OK;
+
+  if (SEMIHOST_SYS_READC == dap_semihost_op)
+  {
+    dap_semihost_result = dap_semihost_in_buf[dap_semihost_in_tail];
+    dap_semihost_in_tail = (dap_semihost_in_tail + 1) % DAP_CONFIG_SEMIHOSTING_BUF_SIZE;
+    dap_semihost_size = 0;
+    return DAP_TRANSFER_OK;
+  }
+
+  if (count > (int)sizeof(data))
+    count = sizeof(data);
+
+  if ((uint32_t)count > dap_semihost_size)
+    count = dap_semihost_size;
+
+  for (int i = 0; i < count; i++)
+    data[i] = dap_semihost_in_buf[(dap_semihost_in_tail + i) % DAP_CONFIG_SEMIHOSTING_BUF_SIZE];
+
+  dap_semihost_in_tail = (dap_semihost_in_tail + count) % DAP_CONFIG_SEMIHOSTING_BUF_SIZE;
+
+  // A console read returns the data that is available, like a terminal does
+  dap_semihost_result -= count;
+  dap_semihost_size = 0;
+
+  return dap_background_write_bytes(dap_semihost_addr, data, count, csw);
+}
+
+//-----------------------------------------------------------------------------
+static int dap_semihost_service(uint32_t dhcsr, uint32_t csw)
+{
+  uint32_t dfsr, insn;
+  int ack = DAP_TRANSFER_OK;
+
+  if (0 == (dhcsr & DHCSR_S_HALT))
+  {
+    // Halt reasons are sticky, so the ones left by a halt of the host debugger
+    // would hide the next semihosting call
+    if (dap_semihost_ignore)
+      dap_semihost_clear = true;
+
+    dap_semihost_ignore = false;
+    dap_semihost_pending = false;
+
+    if (dap_semihost_clear)
+    {
+      ack = dap_background_write_word(DAP_SEMIHOST_DFSR, DAP_SEMIHOST_DFSR_ALL);
+
+      if (DAP_TRANSFER_OK == ack)
+        dap_semihost_clear = false;
+    }
+
+    return ack;
+  }
+
+  if (dap_semihost_ignore)
+    return ack;
+
+  if (!dap_semihost_pending)
+  {
+    // Only a halt caused by BKPT alone may be a semihosting call, a halt request
+    // or a watchpoint at the same time belongs to the host debugger
+    ack = dap_background_read_block(DAP_SEMIHOST_DFSR, 1, &dfsr);
+
+    if (DAP_TRANSFER_OK != ack)
+      return ack;
+
+    if (DFSR_BKPT != (dfsr & (DFSR_HALTED | DFSR_BKPT | DFSR_DWTTRAP | DFSR_VCATCH)))
+    {
+      dap_semihost_ignore = true;
+      return ack;
+    }
+
+    ack = dap_semihost_read_reg(15, &dap_semihost_pc);
+
+    if (DAP_TRANSFER_OK == ack)
+      ack = dap_background_read_block(dap_semihost_pc & ~3ul, 1, &insn);
+
+    if (DAP_TRANSFER_OK != ack)
+      return ack;
+
+    // Other halts belong to the host debugger
+    if (DAP_SEMIHOST_BKPT != ((insn >> ((dap_semihost_pc & 2) * 8)) & 0xffff))
+    {
+      dap_semihost_ignore = true;
+      return ack;
+    }
+
+    ack = dap_semihost_start();
+
+    if (DAP_TRANSFER_OK != ack || dap_semihost_ignore)
+      return ack;
+
+    dap_semihost_pending = true;
+    dap_semihost_calls++;
+  }
+
+  // The target stays halted until the data can be transferred
+  if (dap_semihost_size)
+  {
+    if (SEMIHOST_SYS_READ == dap_semihost_op || SEMIHOST_SYS_READC == dap_semihost_op)
+      ack = dap_semihost_read_in(csw);
+    else
+      ack = dap_semihost_write_out();
+  }
+
+  if (DAP_TRANSFER_OK != ack || dap_semihost_size)
+    return ack;
+
+  // Return the result, step over the BKPT and resume the core
+  if (SEMIHOST_SYS_WRITEC != dap_semihost_op && SEMIHOST_SYS_WRITE0 != dap_semihost_op)
+    ack = dap_semihost_write_reg(0, dap_semihost_result);
+
+  if (DAP_TRANSFER_OK == ack)
+    ack = dap_semihost_write_reg(15, dap_semihost_pc + 2);
+
+  if (DAP_TRANSFER_OK == ack)
+    ack = dap_background_write_word(DAP_SEMIHOST_DFSR, DAP_SEMIHOST_DFSR_ALL);
+
+  if (DAP_TRANSFER_OK == ack)
+    ack = dap_background_write_word(DAP_SEMIHOST_DHCSR, DAP_SEMIHOST_DBGKEY |
+        (dhcsr & (DHCSR_C_DEBUGEN | DHCSR_C_MASKINTS | DHCSR_C_SNAPSTALL)));
+
+  if (DAP_TRANSFER_OK == ack)
+    dap_semihost_pending = false;
+
+  return ack;
+}
+
+//-----------------------------------------------------------------------------
+static void dap_semihost_task(void)
+{
+  dap_background_state_t state;
+  uint32_t now, dhcsr;
+  int ack;
+
+  if (!dap_semihost_enabled || !dap_background_read_ready())
+    return;
+
+  now = DAP_CONFIG_TIMER_US();
+  dap_semihost_elapsed += (uint32_t)(now - dap_semihost_timer);
+  dap_semihost_timer = now;
+
+  if ((int32_t)(now - dap_semihost_next) < 0)
+    return;
+
+  dap_semihost_next = now + dap_semihost_interval;
+
+  ack = dap_background_begin(dap_semihost_select, AP_CSW_ADDRINC_SINGLE, &state);
+
+  if (DAP_TRANSFER_OK == ack)
+    ack = dap_background_read_block(DAP_SEMIHOST_DHCSR, 1, &dhcsr);
+
+  if (DAP_TRANSFER_OK == ack)
+    ack = dap_semihost_service(dhcsr, state.csw);
+
+  dap_background_end(&state, ack);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_ex_semihost_configure(void)
 {
+  uint32_t select = dap_req_get_word();
+  uint32_t interval = dap_req_get_word();
+  uint32_t time = dap_req_get_word();
+  int enable = dap_req_get_byte();
+
+  dap_semihost_enabled = false;
+
+  if (dap_buf_error)
+  {
+    dap_resp_add_byte(DAP_ERROR);
+    return;
+  }
+
+  // CSW, TAR and DRW are in AP register bank 0
+  dap_semihost_select    = select & ~0xf0ul;
+  dap_semihost_interval  = interval;
+  dap_semihost_time      = time;
+  dap_semihost_timer     = DAP_CONFIG_TIMER_US();
+  dap_semihost_next      = dap_semihost_timer;
+  dap_semihost_elapsed   = 0;
+  dap_semihost_calls     = 0;
+  dap_semihost_ignore    = false;
+  dap_semihost_clear     = true;
+  dap_semihost_pending   = false;
+  dap_semihost_op        = 0;
+  dap_semihost_out_head  = 0;
+  dap_semihost_out_tail  = 0;
+  dap_semihost_in_head   = 0;
+  dap_semihost_in_tail   = 0;
+  dap_semihost_enabled   = (enable != 0);
+
   dap_resp_add_byte(DAP_OK);
+}
 
-#ifdef DAP_CONFIG_RESET_TARGET_FN
-  DAP_CONFIG_RESET_TARGET_FN();
-  dap_resp_add_byte(1);
-#else
-  dap_resp_add_byte(0);
+//-----------------------------------------------------------------------------
+static void dap_ex_semihost_status(void)
+{
+  if (!dap_semihost_enabled)
+    dap_resp_add_byte(DAP_SEMIHOST_STOPPED);
+  else if (dap_semihost_pending)
+    dap_resp_add_byte(DAP_SEMIHOST_CALL);
+  else
+    dap_resp_add_byte(DAP_SEMIHOST_RUNNING);
+
+  dap_resp_add_byte(dap_semihost_op);
+  dap_resp_add_word(dap_semihost_calls);
+}
+#endif // DAP_CONFIG_ENABLE_SEMIHOSTING
+
+#ifdef DAP_CONFIG_ENABLE_READ_PIPELINE
+//-----------------------------------------------------------------------------
+static void dap_ex_read_pipeline(void)
+{
+  dap_pipeline_enabled = (0 != dap_req_get_byte());
+
+  dap_resp_add_byte(DAP_OK);
+}
 #endif
+
+#ifdef DAP_CONFIG_ENABLE_PROGRAM
+//-----------------------------------------------------------------------------
+static int dap_program_reg(void)
+{
+  int index = dap_req_get_byte();
+
+  if (index >= DAP_PROGRAM_REG_COUNT)
+  {
+    dap_buf_error = true;
+    return 0;
+  }
+
+  return index;
 }
 
 //-----------------------------------------------------------------------------
-static void dap_swj_pins(void)
+static void dap_program_jump(int base, bool taken)
 {
-  int value  = dap_req_get_byte();
-  int select = dap_req_get_byte();
-  int wait   = dap_req_get_word();
+  int target = dap_req_get_half();
 
-  if (select & DAP_SWJ_SWCLK_TCK)
-    DAP_CONFIG_SWCLK_TCK_write(value & DAP_SWJ_SWCLK_TCK);
+  if (!taken || dap_buf_error)
+    return;
 
-  if (select & DAP_SWJ_SWDIO_TMS)
-    DAP_CONFIG_SWDIO_TMS_write(value & DAP_SWJ_SWDIO_TMS);
+  // A jump to the end of the code terminates the program
+  if (target > (dap_req_size - base))
+    dap_buf_error = true;
+  else
+    dap_req_ptr = base + target;
+}
 
-  if (select & DAP_SWJ_TDI)
-    DAP_CONFIG_TDI_write(value & DAP_SWJ_TDI);
+//-----------------------------------------------------------------------------
+static int dap_program_read(int request, uint32_t *data)
+{
+  int ack;
 
-  if (select & DAP_SWJ_nTRST)
-    DAP_CONFIG_nTRST_write(value & DAP_SWJ_nTRST);
+  if (!dap_needs_posted_read(request))
+    return dap_transfer_word(request, data);
 
-  if (select & DAP_SWJ_nRESET)
-    DAP_CONFIG_nRESET_write(value & DAP_SWJ_nRESET);
+  ack = dap_transfer_word(request, NULL);
 
-  dap_delay_us(wait * 1000);
+  if (DAP_TRANSFER_OK != ack)
+    return ack;
+
+  return dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, data);
+}
+
+//-----------------------------------------------------------------------------
+static void dap_ex_program(void)
+{
+  uint32_t regs[DAP_PROGRAM_REG_COUNT];
+  uint32_t steps, data, start;
+  int count, base, pc, op, request, rd, rs, status, ack;
+  bool verify_write;
+
+  dap_resp_add_byte(DAP_ERROR);
+  dap_resp_add_byte(DAP_TRANSFER_INVALID);
+  dap_resp_add_byte(0); // PC
+  dap_resp_add_byte(0); // PC
+  dap_resp_add_byte(0); // Count
+  dap_resp_add_byte(0); // Count
+
+  if (!dap_select_device(dap_req_get_byte()))
+    return;
+
+  steps = dap_req_get_word();
+  count = dap_req_get_byte();
+
+  if (count > DAP_PROGRAM_REG_COUNT)
+    return;
+
+  for (int i = 0; i < DAP_PROGRAM_REG_COUNT; i++)
+    regs[i] = (i < count) ? dap_req_get_word() : 0;
+
+  if (dap_buf_error)
+    return;
+
+  base   = dap_req_ptr;
+  pc     = 0;
+  count  = 0;
+  status = DAP_ERROR;
+  ack    = DAP_TRANSFER_OK;
+  verify_write = false;
+  start  = DAP_CONFIG_TIMER_US();
+
+  for (; steps && !dap_abort; steps--)
+  {
+    pc = dap_req_ptr - base;
+
+    if ((DAP_CONFIG_TIMER_US() - start) >= DAP_PROGRAM_TIME_MAX)
+      break;
+
+    if (dap_req_ptr == dap_req_size)
+    {
+      status = DAP_OK;
+      break;
+    }
+
+    op = dap_req_get_byte();
+
+    if (DAP_PROGRAM_END == op)
+    {
+      status = DAP_OK;
+      break;
+    }
+    else if (DAP_PROGRAM_READ == op)
+    {
+      request = dap_req_get_byte() & (DAP_TRANSFER_APnDP | DAP_TRANSFER_A2 | DAP_TRANSFER_A3);
+      rd = dap_program_reg();
+
+      if (dap_buf_error)
+        break;
+
+      ack = dap_program_read(request | DAP_TRANSFER_RnW, &regs[rd]);
+      verify_write = false;
+    }
+    else if (DAP_PROGRAM_WRITE == op)
+    {
+      request = dap_req_get_byte() & (DAP_TRANSFER_APnDP | DAP_TRANSFER_A2 | DAP_TRANSFER_A3);
+      data = regs[dap_program_reg()];
+
+      if (dap_buf_error)
+        break;
+
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+      if (dap_cache_hit(request, data))
+        continue;
+#endif
+
+      ack = dap_transfer_word(request, &data);
+      verify_write = true;
+    }
+    else if (DAP_PROGRAM_LOAD == op || DAP_PROGRAM_ADDI == op || DAP_PROGRAM_ANDI == op)
+    {
+      rd = dap_program_reg();
+      data = dap_req_get_word();
+
+      if (DAP_PROGRAM_LOAD == op)
+        regs[rd] = data;
+      else if (DAP_PROGRAM_ADDI == op)
+        regs[rd] += data;
+      else
+        regs[rd] &= data;
+    }
+    else if (DAP_PROGRAM_MOV <= op && op <= DAP_PROGRAM_SHR)
+    {
+      rd = dap_program_reg();
+      data = regs[dap_program_reg()];
+
+      if (DAP_PROGRAM_MOV == op)
+        regs[rd] = data;
+      else if (DAP_PROGRAM_ADD == op)
+        regs[rd] += data;
+      else if (DAP_PROGRAM_SUB == op)
+        regs[rd] -= data;
+      else if (DAP_PROGRAM_AND == op)
+        regs[rd] &= data;
+      else if (DAP_PROGRAM_OR == op)
+        regs[rd] |= data;
+      else if (DAP_PROGRAM_XOR == op)
+        regs[rd] ^= data;
+      else if (DAP_PROGRAM_SHL == op)
+        regs[rd] <<= (data & 31);
+      else
+        regs[rd] >>= (data & 31);
+    }
+    else if (DAP_PROGRAM_JMP == op)
+    {
+      dap_program_jump(base, true);
+    }
+    else if (DAP_PROGRAM_JZ == op || DAP_PROGRAM_JNZ == op)
+    {
+      data = regs[dap_program_reg()];
+      dap_program_jump(base, (0 == data) == (DAP_PROGRAM_JZ == op));
+    }
+    else if (DAP_PROGRAM_JEQ <= op && op <= DAP_PROGRAM_JLO)
+    {
+      rd = dap_program_reg();
+      rs = dap_program_reg();
+
+      if (DAP_PROGRAM_JEQ == op)
+        dap_program_jump(base, regs[rd] == regs[rs]);
+      else if (DAP_PROGRAM_JNE == op)
+        dap_program_jump(base, regs[rd] != regs[rs]);
+      else
+        dap_program_jump(base, regs[rd] < regs[rs]);
+    }
+    else if (DAP_PROGRAM_DJNZ == op)
+    {
+      rd = dap_program_reg();
+      regs[rd]--;
+      dap_program_jump(base, 0 != regs[rd]);
+    }
+    else if (DAP_PROGRAM_OUT == op)
+    {
+      dap_resp_add_word(regs[dap_program_reg()]);
+
+      if (!dap_buf_error)
+        count++;
+    }
+    else if (DAP_PROGRAM_DELAY == op)
+    {
+      dap_delay_us(dap_req_get_half());
+    }
+    else
+    {
+      dap_buf_error = true;
+    }
+
+    if (DAP_TRANSFER_OK != ack || dap_buf_error)
+      break;
+  }
+
+  // The last posted write is only confirmed by the next transaction
+  if (DAP_TRANSFER_OK == ack && verify_write)
+  {
+    ack = dap_transfer_word(SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW, NULL);
+
+    if (DAP_TRANSFER_OK != ack)
+      status = DAP_ERROR;
+  }
+
+#ifdef DAP_CONFIG_ENABLE_AUTO_RECOVERY
+  dap_recover(ack);
+#endif
+
+  dap_resp_set_byte(1, status);
+  dap_resp_set_byte(2, ack);
+  dap_resp_set_byte(3, pc);
+  dap_resp_set_byte(4, pc >> 8);
+  dap_resp_set_byte(5, count);
+  dap_resp_set_byte(6, count >> 8);
+}
+#endif // DAP_CONFIG_ENABLE_PROGRAM
+
+//-----------------------------------------------------------------------------
+void dap_init(void)
+{
+  dap_port              = DAP_PORT_DISABLED;
+  dap_abort             = false;
+  dap_match_mask        = 0;
+  dap_idle_cycles       = 0;
+  dap_retry_count       = 100;
+  dap_match_retry_count = 100;
+  dap_swd_turnaround    = 1;
+  dap_swd_data_phase    = false;
+#ifdef DAP_CONFIG_ENABLE_JTAG
+  dap_jtag_dev_count = 0;
+#endif
+#ifdef DAP_CONFIG_ENABLE_LINK_MONITOR
+  dap_link_enabled      = false;
+  dap_link_freq         = DAP_CONFIG_DEFAULT_CLOCK;
+  dap_link_window       = 256;
+  dap_link_threshold    = 4;
+  dap_link_clean_limit  = 4096;
+#endif
+#ifdef DAP_CONFIG_ENABLE_GANG
+  dap_gang_lanes        = 0;
+#endif
+#ifdef DAP_CONFIG_ENABLE_MULTIDROP
+  dap_multidrop_count   = 0;
+  dap_multidrop_index   = -1;
+#endif
+#ifdef DAP_CONFIG_ENABLE_ORUN_WRITE
+  dap_orun_write_enabled = false;
+#endif
+#ifdef DAP_CONFIG_ENABLE_AUTO_RECOVERY
+  dap_recovery_enabled  = false;
+  dap_recovery_line_error = false;
+  dap_recovery_count    = 0;
+#endif
+#ifdef DAP_CONFIG_ENABLE_MATCH_TIMEOUT
+  dap_match_timeout     = 0;
+  dap_match_interval    = 0;
+#endif
+#ifdef DAP_CONFIG_ENABLE_PREFETCH
+  dap_prefetch_range_count = 0;
+  dap_prefetch_busy     = false;
+#endif
+#ifdef DAP_CONFIG_ENABLE_STREAM
+  dap_stream_active     = false;
+#endif
+#ifdef DAP_CONFIG_ENABLE_SAMPLING
+  dap_sample_period     = 0;
+#endif
+#ifdef DAP_CONFIG_ENABLE_WATCH
+  dap_watch_count       = 0;
+#endif
+#ifdef DAP_CONFIG_ENABLE_PCSR
+  dap_pcsr_enabled      = false;
+  dap_pcsr_count        = 0;
+#endif
+#ifdef DAP_CONFIG_ENABLE_RTT
+  dap_rtt_state         = DAP_RTT_STOPPED;
+  dap_rtt_cb            = 0;
+#endif
+#ifdef DAP_CONFIG_ENABLE_SEMIHOSTING
+  dap_semihost_enabled  = false;
+  dap_semihost_pending  = false;
+#endif
+#ifdef DAP_CONFIG_ENABLE_READ_PIPELINE
+  dap_pipeline_enabled  = false;
+  dap_pipeline_open     = false;
+#endif
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+  dap_cache_enabled     = false;
+  dap_cache_invalidate();
+#endif
+#ifdef DAP_CONFIG_ENABLE_ADAPTIVE_WAIT
+  dap_wait_enabled      = false;
+  dap_wait_ap           = 0;
+#endif
 
-  value =
-    (DAP_CONFIG_SWCLK_TCK_read() ? DAP_SWJ_SWCLK_TCK : 0) |
-    (DAP_CONFIG_SWDIO_TMS_read() ? DAP_SWJ_SWDIO_TMS : 0) |
-    (DAP_CONFIG_TDI_read()       ? DAP_SWJ_TDI       : 0) |
-    (DAP_CONFIG_TDO_read()       ? DAP_SWJ_TDO       : 0) |
-    (DAP_CONFIG_nTRST_read()     ? DAP_SWJ_nTRST     : 0) |
-    (DAP_CONFIG_nRESET_read()    ? DAP_SWJ_nRESET    : 0);
+  dap_setup_clock(DAP_CONFIG_DEFAULT_CLOCK);
 
-  dap_resp_add_byte(value);
+  DAP_CONFIG_SETUP();
 }
 
 //-----------------------------------------------------------------------------
-static void dap_swj_clock(void)
+void dap_background_task(void)
 {
-  int freq = dap_req_get_word();
-  dap_setup_clock(freq);
-  dap_resp_add_byte(DAP_OK);
+#ifdef DAP_CONFIG_ENABLE_PREFETCH
+  dap_prefetch_fill();
+#endif
+#ifdef DAP_CONFIG_ENABLE_WATCH
+  dap_watch_task();
+#endif
+#ifdef DAP_CONFIG_ENABLE_SAMPLING
+  dap_sample_task();
+#endif
+#ifdef DAP_CONFIG_ENABLE_PCSR
+  dap_pcsr_task();
+#endif
+#ifdef DAP_CONFIG_ENABLE_RTT
+  dap_rtt_task();
+#endif
+#ifdef DAP_CONFIG_ENABLE_SEMIHOSTING
+  dap_semihost_task();
+#endif
 }
 
 //-----------------------------------------------------------------------------
-static void dap_swj_sequence(void)
+int dap_stream_task(uint8_t *resp, int resp_size)
 {
-  int size = dap_req_get_byte();
+#ifdef DAP_CONFIG_ENABLE_STREAM
+  if (dap_stream_active && dap_stream_read && dap_stream_credits > 0)
+  {
+    dap_buf_init(NULL, 0, resp, resp_size);
+    return dap_stream_read_packet();
+  }
+#endif
 
-  while (size)
+#ifdef DAP_CONFIG_ENABLE_SAMPLING
+  if (dap_sample_credits > 0 && dap_sample_tail != dap_sample_head)
   {
-    int sz = (size > 8) ? 8 : size;
-    dap_swd_write(dap_req_get_byte(), sz);
-    size -= sz;
+    dap_buf_init(NULL, 0, resp, resp_size);
+    return dap_sample_packet();
   }
+#endif
 
-  dap_resp_add_byte(DAP_OK);
+  (void)resp;
+  (void)resp_size;
+  return 0;
 }
 
 //-----------------------------------------------------------------------------
-static void dap_swd_configure(void)
+bool dap_rtt_active(void)
 {
-  int data = dap_req_get_byte();
-
-  dap_swd_turnaround = (data & 3) + 1;
-  dap_swd_data_phase = (data & 4) ? 1 : 0;
-
-  dap_resp_add_byte(DAP_OK);
+#ifdef DAP_CONFIG_ENABLE_RTT
+  return DAP_RTT_STOPPED != dap_rtt_state;
+#else
+  return false;
+#endif
 }
 
 //-----------------------------------------------------------------------------
-static void dap_swd_sequence(void)
+int dap_rtt_read(uint8_t *data, int size)
 {
-  int req_count;
-
-  if (DAP_PORT_SWD != dap_port)
-  {
-    dap_resp_add_byte(DAP_ERROR);
-    return;
-  }
-
-  dap_resp_add_byte(DAP_OK);
+  int count = 0;
 
-  req_count = dap_req_get_byte();
-
-  for (int i = 0; i < req_count; i++)
+#ifdef DAP_CONFIG_ENABLE_RTT
+  while (count < size && dap_rtt_up_tail != dap_rtt_up_head)
   {
-    int info  = dap_req_get_byte();
-    int count = info & SWD_SEQUENCE_COUNT;
-    int din   = info & SWD_SEQUENCE_DIN;
-
-    if (count == 0)
-      count = 64U;
-
-    if (din)
-    {
-      DAP_CONFIG_SWDIO_TMS_in();
-
-      while (count)
-      {
-        int sz = (count > 8) ? 8 : count;
-        int value = dap_swd_read(sz);
-        dap_resp_add_byte(value);
-        count -= sz;
-      }
-    }
-    else
-    {
-      DAP_CONFIG_SWDIO_TMS_out();
-
-      while (count)
-      {
-        int sz = (count > 8) ? 8 : count;
-        dap_swd_write(dap_req_get_byte(), sz);
-        count -= sz;
-      }
-    }
+    data[count++] = dap_rtt_up_buf[dap_rtt_up_tail];
+    dap_rtt_up_tail = (dap_rtt_up_tail + 1) % DAP_CONFIG_RTT_BUF_SIZE;
   }
+#else
+  (void)data;
+  (void)size;
+#endif
 
-  DAP_CONFIG_SWDIO_TMS_out();
+  return count;
 }
 
 //-----------------------------------------------------------------------------
-static void dap_jtag_sequence(void)
+int dap_rtt_write(uint8_t *data, int size)
 {
-#ifdef DAP_CONFIG_ENABLE_JTAG
-  int req_count;
-
-  if (DAP_PORT_JTAG != dap_port)
-  {
-    dap_resp_add_byte(DAP_ERROR);
-    return;
-  }
-
-  dap_resp_add_byte(DAP_OK);
+  int count = 0;
 
-  req_count = dap_req_get_byte();
+#ifdef DAP_CONFIG_ENABLE_RTT
+  int head = (dap_rtt_down_head + 1) % DAP_CONFIG_RTT_BUF_SIZE;
 
-  for (int i = 0; i < req_count; i++)
+  while (count < size && head != dap_rtt_down_tail)
   {
-    int info  = dap_req_get_byte();
-    int count = info & JTAG_SEQUENCE_COUNT;
-    int tms   = info & JTAG_SEQUENCE_TMS;
-    int tdo   = info & JTAG_SEQUENCE_TDO;
-
-    if (count == 0)
-      count = 64;
-
-    DAP_CONFIG_SWDIO_TMS_write(tms);
-
-    while (count)
-    {
-      int sz = (count > 8) ? 8 : count;
+    dap_rtt_down_buf[dap_rtt_down_head] = data[count++];
+    dap_rtt_down_head = head;
+    head = (head + 1) % DAP_CONFIG_RTT_BUF_SIZE;
+  }
+#else
+  (void)data;
+  (void)size;
+#endif
 
-      if (tdo)
-      {
-        int value = dap_jtag_rdwr(dap_req_get_byte(), sz);
-        dap_resp_add_byte(value);
-      }
-      else
-      {
-        dap_jtag_write(dap_req_get_byte(), sz);
-      }
+  return count;
+}
 
-      count -= sz;
-    }
-  }
+//-----------------------------------------------------------------------------
+bool dap_semihost_active(void)
+{
+#ifdef DAP_CONFIG_ENABLE_SEMIHOSTING
+  return dap_semihost_enabled;
 #else
-  dap_resp_add_byte(DAP_ERROR);
+  return false;
 #endif
 }
 
 //-----------------------------------------------------------------------------
-static void dap_jtag_configure(void)
+int dap_semihost_read(uint8_t *data, int size)
 {
-#ifdef DAP_CONFIG_ENABLE_JTAG
-  int count = dap_req_get_byte();
-  int bits = 0;
+  int count = 0;
 
-  if (count > DAP_CONFIG_JTAG_DEV_COUNT)
+#ifdef DAP_CONFIG_ENABLE_SEMIHOSTING
+  while (count < size && dap_semihost_out_tail != dap_semihost_out_head)
   {
-    dap_resp_add_byte(DAP_ERROR);
-    return;
+    data[count++] = dap_semihost_out_buf[dap_semihost_out_tail];
+    dap_semihost_out_tail = (dap_semihost_out_tail + 1) % DAP_CONFIG_SEMIHOSTING_BUF_SIZE;
   }
+#else
+  (void)data;
+  (void)size;
+#endif
 
-  dap_jtag_dev_count = count;
-  dap_jtag_dev_index = 0;
+  return count;
+}
 
-  for (int i = 0; i < dap_jtag_dev_count; i++)
-  {
-    dap_jtag_ir_length[i] = dap_req_get_byte();
-    dap_jtag_ir_before[i] = bits;
-    bits += dap_jtag_ir_length[i];
-  }
+//-----------------------------------------------------------------------------
+int dap_semihost_write(uint8_t *data, int size)
+{
+  int count = 0;
 
-  for (int i = 0; i < dap_jtag_dev_count; i++)
+#ifdef DAP_CONFIG_ENABLE_SEMIHOSTING
+  int head = (dap_semihost_in_head + 1) % DAP_CONFIG_SEMIHOSTING_BUF_SIZE;
+
+  while (count < size && head != dap_semihost_in_tail)
   {
-    bits -= dap_jtag_ir_length[i];
-    dap_jtag_ir_after[i] = bits;
+    dap_semihost_in_buf[dap_semihost_in_head] = data[count++];
+    dap_semihost_in_head = head;
+    head = (head + 1) % DAP_CONFIG_SEMIHOSTING_BUF_SIZE;
   }
-
-  dap_resp_add_byte(DAP_OK);
 #else
-  dap_resp_add_byte(DAP_ERROR);
+  (void)data;
+  (void)size;
 #endif
+
+  return count;
 }
 
 //-----------------------------------------------------------------------------
-static void dap_jtag_idcode(void)
+bool dap_request_complete(uint8_t *req, int size)
 {
-#ifdef DAP_CONFIG_ENABLE_JTAG
-  uint32_t data;
+  int cmd, count, ptr;
 
-  if (DAP_PORT_JTAG != dap_port || !dap_select_device(dap_req_get_byte()))
+  // Only the commands that may be longer than a single USB packet are parsed,
+  // other requests end with a short or a zero-length packet
+  if (size < 2)
+    return false;
+
+  cmd = req[0];
+
+  if (ID_DAP_TRANSFER == cmd)
   {
-    dap_resp_add_byte(DAP_ERROR);
-    return;
-  }
+    if (size < 3)
+      return false;
 
-  dap_jtag_write_ir(JTAG_IDCODE);
+    count = req[2];
+    ptr = 3;
 
-  DAP_CONFIG_SWDIO_TMS_write(1);
-  dap_swj_run(1); // -> Select-DR-Scan
-  DAP_CONFIG_SWDIO_TMS_write(0);
-  dap_swj_run(2 + dap_jtag_dev_index); // -> Shift-DR
+    for (; count && ptr < size; count--)
+    {
+      int request = req[ptr++];
 
-  data = dap_jtag_read(31);
+      if (0 == (request & DAP_TRANSFER_RnW) || (request & DAP_TRANSFER_MATCH_VALUE))
+        ptr += 4;
+    }
 
-  DAP_CONFIG_SWDIO_TMS_write(1);
-  data |= (dap_jtag_read(1) << 31); // -> Exit1-DR
+    return 0 == count && ptr <= size;
+  }
+  else if (ID_DAP_TRANSFER_BLOCK == cmd)
+  {
+    if (size < 5)
+      return false;
 
-  dap_swj_run(1); // -> Update-DR
-  DAP_CONFIG_SWDIO_TMS_write(0);
-  dap_swj_run(1); // -> Idle
-  DAP_CONFIG_TDI_write(1);
+    count = req[2] | (req[3] << 8);
+    ptr = 5;
 
-  dap_resp_add_byte(DAP_OK);
-  dap_resp_add_word(data);
-#endif
-}
+    if (0 == (req[4] & DAP_TRANSFER_RnW))
+      ptr += count * 4;
 
-//-----------------------------------------------------------------------------
-void dap_init(void)
-{
-  dap_port              = DAP_PORT_DISABLED;
-  dap_abort             = false;
-  dap_match_mask        = 0;
-  dap_idle_cycles       = 0;
-  dap_retry_count       = 100;
-  dap_match_retry_count = 100;
-  dap_swd_turnaround    = 1;
-  dap_swd_data_phase    = false;
-#ifdef DAP_CONFIG_ENABLE_JTAG
-  dap_jtag_dev_count = 0;
-#endif
+    return ptr <= size;
+  }
+  else if (ID_DAP_SWJ_SEQUENCE == cmd)
+  {
+    return (2 + (req[1] + 7) / 8) <= size;
+  }
+  else if (ID_DAP_SWD_SEQUENCE == cmd || ID_DAP_JTAG_SEQUENCE == cmd)
+  {
+    count = req[1];
+    ptr = 2;
 
-  dap_setup_clock(DAP_CONFIG_DEFAULT_CLOCK);
+    for (; count && ptr < size; count--)
+    {
+      int info = req[ptr++];
+      int bits = (info & SWD_SEQUENCE_COUNT) ? (info & SWD_SEQUENCE_COUNT) : 64;
 
-  DAP_CONFIG_SETUP();
+      // SWD input sequences have no data in the request
+      if (ID_DAP_JTAG_SEQUENCE == cmd || 0 == (info & SWD_SEQUENCE_DIN))
+        ptr += (bits + 7) / 8;
+    }
+
+    return 0 == count && ptr <= size;
+  }
+
+  return false;
 }
 
 //-----------------------------------------------------------------------------
@@ -1451,6 +6026,76 @@ int dap_process_request(uint8_t *req, int req_size, uint8_t *resp, int resp_size
     { ID_DAP_JTAG_SEQUENCE,		dap_jtag_sequence },
     { ID_DAP_JTAG_CONFIGURE,		dap_jtag_configure },
     { ID_DAP_JTAG_IDCODE,		dap_jtag_idcode },
+#ifdef DAP_CONFIG_ENABLE_CLOCK_DISCOVERY
+    { ID_DAP_EX_DISCOVER_CLOCK,		dap_ex_discover_clock },
+#endif
+#ifdef DAP_CONFIG_ENABLE_LINK_MONITOR
+    { ID_DAP_EX_LINK_CONFIGURE,		dap_ex_link_configure },
+    { ID_DAP_EX_LINK_STATUS,		dap_ex_link_status },
+#endif
+#ifdef DAP_CONFIG_ENABLE_GANG
+    { ID_DAP_EX_GANG_CONFIGURE,		dap_ex_gang_configure },
+    { ID_DAP_EX_GANG_TRANSFER,		dap_ex_gang_transfer },
+    { ID_DAP_EX_GANG_TRANSFER_BLOCK,	dap_ex_gang_transfer_block },
+#endif
+#ifdef DAP_CONFIG_ENABLE_MULTIDROP
+    { ID_DAP_EX_MULTIDROP_CONFIGURE,	dap_ex_multidrop_configure },
+#endif
+#ifdef DAP_CONFIG_ENABLE_ORUN_WRITE
+    { ID_DAP_EX_ORUN_WRITE,		dap_ex_orun_write },
+#endif
+#ifdef DAP_CONFIG_ENABLE_AUTO_RECOVERY
+    { ID_DAP_EX_RECOVERY_CONFIGURE,	dap_ex_recovery_configure },
+#endif
+#ifdef DAP_CONFIG_ENABLE_ADAPTIVE_WAIT
+    { ID_DAP_EX_ADAPTIVE_WAIT,		dap_ex_adaptive_wait },
+#endif
+#ifdef DAP_CONFIG_ENABLE_MATCH_TIMEOUT
+    { ID_DAP_EX_MATCH_TIMEOUT,		dap_ex_match_timeout },
+#endif
+#ifdef DAP_CONFIG_ENABLE_WRITE_CACHE
+    { ID_DAP_EX_WRITE_CACHE,		dap_ex_write_cache },
+#endif
+#ifdef DAP_CONFIG_ENABLE_PREFETCH
+    { ID_DAP_EX_PREFETCH_CONFIGURE,	dap_ex_prefetch_configure },
+#endif
+#ifdef DAP_CONFIG_ENABLE_MEM_BLOCK
+    { ID_DAP_EX_MEM_BLOCK,		dap_ex_mem_block },
+#endif
+#ifdef DAP_CONFIG_ENABLE_SCATTER
+    { ID_DAP_EX_SCATTER,		dap_ex_scatter },
+#endif
+#ifdef DAP_CONFIG_ENABLE_SAMPLING
+    { ID_DAP_EX_SAMPLE_CONFIGURE,	dap_ex_sample_configure },
+    { ID_DAP_EX_SAMPLE_DATA,		dap_ex_sample_data },
+#endif
+#ifdef DAP_CONFIG_ENABLE_WATCH
+    { ID_DAP_EX_WATCH_CONFIGURE,	dap_ex_watch_configure },
+    { ID_DAP_EX_WATCH_EVENT,		dap_ex_watch_event },
+#endif
+#ifdef DAP_CONFIG_ENABLE_PCSR
+    { ID_DAP_EX_PCSR_CONFIGURE,		dap_ex_pcsr_configure },
+    { ID_DAP_EX_PCSR_READ,		dap_ex_pcsr_read },
+#endif
+#ifdef DAP_CONFIG_ENABLE_RTT
+    { ID_DAP_EX_RTT_CONFIGURE,		dap_ex_rtt_configure },
+    { ID_DAP_EX_RTT_STATUS,		dap_ex_rtt_status },
+#endif
+#ifdef DAP_CONFIG_ENABLE_SEMIHOSTING
+    { ID_DAP_EX_SEMIHOST_CONFIGURE,	dap_ex_semihost_configure },
+    { ID_DAP_EX_SEMIHOST_STATUS,	dap_ex_semihost_status },
+#endif
+#ifdef DAP_CONFIG_ENABLE_READ_PIPELINE
+    { ID_DAP_EX_READ_PIPELINE,		dap_ex_read_pipeline },
+#endif
+#ifdef DAP_CONFIG_ENABLE_STREAM
+    { ID_DAP_EX_STREAM,			dap_ex_stream },
+    { ID_DAP_EX_STREAM_CREDIT,		dap_ex_stream_credit },
+    { ID_DAP_EX_STREAM_DATA,		dap_ex_stream_data },
+#endif
+#ifdef DAP_CONFIG_ENABLE_PROGRAM
+    { ID_DAP_EX_PROGRAM,		dap_ex_program },
+#endif
   };
   int cmd;
 
@@ -1462,9 +6107,25 @@ int dap_process_request(uint8_t *req, int req_size, uint8_t *resp, int resp_size
   dap_jtag_ir = JTAG_INVALID;
 #endif
 
+#ifdef DAP_CONFIG_ENABLE_READ_PIPELINE
+  dap_pipeline_check(req, req_size);
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_AUTO_RECOVERY
+  dap_recovery_line_error = false;
+#endif
+
   cmd = dap_req_get_byte();
   dap_resp_add_byte(cmd);
 
+#ifdef DAP_CONFIG_ENABLE_STREAM
+  dap_stream_check(cmd);
+#endif
+
+#ifdef DAP_CONFIG_ENABLE_SAMPLING
+  dap_sample_check(cmd);
+#endif
+
   for (int i = 0; i < ARRAY_SIZE(handlers); i++)
   {
     if (cmd == handlers[i].cmd)
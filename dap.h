@@ -42,8 +42,17 @@ void dap_resp_add_byte(uint8_t value);
 void dap_resp_add_word(uint32_t value);
 void dap_resp_set_byte(int index, uint8_t value);
 bool dap_is_buf_error(void);
+bool dap_request_complete(uint8_t *req, int size);
 bool dap_filter_request(uint8_t *req);
 int dap_process_request(uint8_t *req, int req_size, uint8_t *resp, int resp_size);
+void dap_background_task(void);
+int dap_stream_task(uint8_t *resp, int resp_size);
+bool dap_rtt_active(void);
+int dap_rtt_read(uint8_t *data, int size);
+int dap_rtt_write(uint8_t *data, int size);
+bool dap_semihost_active(void);
+int dap_semihost_read(uint8_t *data, int size);
+int dap_semihost_write(uint8_t *data, int size);
 void dap_clock_test(int delay);
 
 #endif // _DAP_H_
@@ -29,7 +29,10 @@
 //#define DAP_CONFIG_VENDOR_FN           vendor_command_handler_function
 
 // Attribute to use for performance-critical functions
-#define DAP_CONFIG_PERFORMANCE_ATTR
+#define DAP_CONFIG_PERFORMANCE_ATTR    __attribute__((section(".ramfunc")))
+
+// Attribute to use for the transfer command handlers
+#define DAP_CONFIG_TRANSFER_ATTR       __attribute__((section(".ramfunc")))
 
 // A value at which dap_clock_test() produces 1 kHz output on the SWCLK pin
 #define DAP_CONFIG_DELAY_CONSTANT      19000
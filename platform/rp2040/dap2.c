@@ -0,0 +1,34 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2022, Alex Taradov <alex@taradov.com>. All rights reserved.
+
+// Second independent CMSIS-DAP instance. It is served by the core 1 and uses
+// the pins defined in hal_config.h for DAP_CONFIG_INSTANCE == 2.
+//
+// dap.c is compiled for the second time, which produces a completely independent
+// instance with its own state. Public functions of that instance have "dap2_"
+// prefix and are declared in dap2.h.
+
+#define DAP_CONFIG_INSTANCE    2
+
+#define dap_init              dap2_init
+#define dap_req_get_byte      dap2_req_get_byte
+#define dap_req_get_half      dap2_req_get_half
+#define dap_req_get_word      dap2_req_get_word
+#define dap_resp_add_byte     dap2_resp_add_byte
+#define dap_resp_add_word     dap2_resp_add_word
+#define dap_resp_set_byte     dap2_resp_set_byte
+#define dap_is_buf_error      dap2_is_buf_error
+#define dap_request_complete  dap2_request_complete
+#define dap_filter_request    dap2_filter_request
+#define dap_process_request   dap2_process_request
+#define dap_background_task   dap2_background_task
+#define dap_stream_task       dap2_stream_task
+#define dap_rtt_active        dap2_rtt_active
+#define dap_rtt_read          dap2_rtt_read
+#define dap_rtt_write         dap2_rtt_write
+#define dap_semihost_active   dap2_semihost_active
+#define dap_semihost_read     dap2_semihost_read
+#define dap_semihost_write    dap2_semihost_write
+#define dap_clock_test        dap2_clock_test
+
+#include "dap.c"
@@ -0,0 +1,19 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2022, Alex Taradov <alex@taradov.com>. All rights reserved.
+
+#ifndef _DAP2_H_
+#define _DAP2_H_
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+
+/*- Prototypes --------------------------------------------------------------*/
+void dap2_init(void);
+bool dap2_request_complete(uint8_t *req, int size);
+bool dap2_filter_request(uint8_t *req);
+int dap2_process_request(uint8_t *req, int req_size, uint8_t *resp, int resp_size);
+void dap2_background_task(void);
+int dap2_stream_task(uint8_t *resp, int resp_size);
+
+#endif // _DAP2_H_
@@ -10,15 +10,67 @@
 
 /*- Definitions -------------------------------------------------------------*/
 #define DAP_CONFIG_ENABLE_JTAG
+#define DAP_CONFIG_ENABLE_CLOCK_DISCOVERY
+#define DAP_CONFIG_ENABLE_LINK_MONITOR
+#define DAP_CONFIG_ENABLE_MULTIDROP
+#define DAP_CONFIG_ENABLE_ORUN_WRITE
+#define DAP_CONFIG_ENABLE_AUTO_RECOVERY
+#define DAP_CONFIG_ENABLE_ADAPTIVE_WAIT
+#define DAP_CONFIG_ENABLE_MATCH_TIMEOUT
+#define DAP_CONFIG_ENABLE_WRITE_CACHE
+#define DAP_CONFIG_ENABLE_PREFETCH
+#define DAP_CONFIG_ENABLE_MEM_BLOCK
+#define DAP_CONFIG_ENABLE_SCATTER
+#define DAP_CONFIG_ENABLE_READ_PIPELINE
+#define DAP_CONFIG_ENABLE_PROGRAM
+
+// Gang mode lanes, streaming, sampling, watch events, PC sampling, the RTT
+// bridge and semihosting are only available to the first instance
+#ifndef DAP_CONFIG_INSTANCE
+#define DAP_CONFIG_ENABLE_GANG
+#define DAP_CONFIG_ENABLE_STREAM
+#define DAP_CONFIG_ENABLE_SAMPLING
+#define DAP_CONFIG_ENABLE_WATCH
+#define DAP_CONFIG_ENABLE_PCSR
+#define DAP_CONFIG_ENABLE_RTT
+#define DAP_CONFIG_ENABLE_SEMIHOSTING
+#endif
 
 #define DAP_CONFIG_DEFAULT_PORT        DAP_PORT_SWD
 #define DAP_CONFIG_DEFAULT_CLOCK       1000000 // Hz
 
-#define DAP_CONFIG_PACKET_SIZE         64
+// Large bulk packets need a zero-length packet after some requests (see README.md)
+#ifdef USE_LARGE_PACKETS
+  #define DAP_CONFIG_PACKET_SIZE       512
+#else
+  #define DAP_CONFIG_PACKET_SIZE       64
+#endif
 #define DAP_CONFIG_PACKET_COUNT        1
 
 #define DAP_CONFIG_JTAG_DEV_COUNT      8
 
+#define DAP_CONFIG_MULTIDROP_COUNT     8
+
+#define DAP_CONFIG_ADAPTIVE_WAIT_AP_COUNT 4
+
+#define DAP_CONFIG_WRITE_CACHE_AP_COUNT 4
+
+#define DAP_CONFIG_PREFETCH_SIZE       1024
+#define DAP_CONFIG_PREFETCH_RANGE_COUNT 4
+
+#define DAP_CONFIG_GANG_COUNT          8
+
+#define DAP_CONFIG_SAMPLE_COUNT        16
+#define DAP_CONFIG_SAMPLE_BUF_SIZE     4096
+
+#define DAP_CONFIG_WATCH_COUNT         8
+
+#define DAP_CONFIG_PCSR_BUCKET_COUNT   2048
+
+#define DAP_CONFIG_RTT_BUF_SIZE        1024
+
+#define DAP_CONFIG_SEMIHOSTING_BUF_SIZE 1024
+
 // DAP_CONFIG_PRODUCT_STR must contain "CMSIS-DAP" to be compatible with the standard
 #define DAP_CONFIG_VENDOR_STR          "Alex Taradov"
 #define DAP_CONFIG_PRODUCT_STR         "Generic CMSIS-DAP Adapter"
@@ -29,14 +81,27 @@
 //#define DAP_CONFIG_VENDOR_FN           vendor_command_handler_function
 
 // Attribute to use for performance-critical functions
-#define DAP_CONFIG_PERFORMANCE_ATTR
+#define DAP_CONFIG_PERFORMANCE_ATTR    __attribute__((section(".ramfunc")))
+
+// Attribute to use for the transfer command handlers
+#define DAP_CONFIG_TRANSFER_ATTR       __attribute__((section(".ramfunc")))
+
+#if F_CPU == 240000000
+// Experimental, scaled from the 120 MHz values and not calibrated on the hardware
+// A value at which dap_clock_test() produces 1 kHz output on the SWCLK pin
+#define DAP_CONFIG_DELAY_CONSTANT      40000
 
+// A threshold for switching to fast clock (no added delays)
+// This is the frequency produced by dap_clock_test(1) on the SWCLK pin
+#define DAP_CONFIG_FAST_CLOCK          17100000 // Hz
+#else
 // A value at which dap_clock_test() produces 1 kHz output on the SWCLK pin
 #define DAP_CONFIG_DELAY_CONSTANT      20000
 
 // A threshold for switching to fast clock (no added delays)
 // This is the frequency produced by dap_clock_test(1) on the SWCLK pin
 #define DAP_CONFIG_FAST_CLOCK          8550000 // Hz
+#endif
 
 /*- Prototypes --------------------------------------------------------------*/
 extern char usb_serial_number[16];
@@ -155,6 +220,30 @@ static inline void DAP_CONFIG_SWDIO_TMS_out(void)
   HAL_GPIO_SWDIO_TMS_out();
 }
 
+//-----------------------------------------------------------------------------
+static inline void DAP_CONFIG_GANG_SWDIO_write(uint32_t lanes)
+{
+  SIO->GPIO_OUT_XOR = (SIO->GPIO_OUT ^ (lanes << GANG_SWDIO_SHIFT)) & GANG_SWDIO_MASK;
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t DAP_CONFIG_GANG_SWDIO_read(void)
+{
+  return (SIO->GPIO_IN & GANG_SWDIO_MASK) >> GANG_SWDIO_SHIFT;
+}
+
+//-----------------------------------------------------------------------------
+static inline void DAP_CONFIG_GANG_SWDIO_in(uint32_t lanes)
+{
+  SIO->GPIO_OE_CLR = (lanes << GANG_SWDIO_SHIFT) & GANG_SWDIO_MASK;
+}
+
+//-----------------------------------------------------------------------------
+static inline void DAP_CONFIG_GANG_SWDIO_out(uint32_t lanes)
+{
+  SIO->GPIO_OE_SET = (lanes << GANG_SWDIO_SHIFT) & GANG_SWDIO_MASK;
+}
+
 //-----------------------------------------------------------------------------
 static inline void DAP_CONFIG_SETUP(void)
 {
@@ -165,6 +254,16 @@ static inline void DAP_CONFIG_SETUP(void)
   HAL_GPIO_TDO_in();
   HAL_GPIO_TDI_in();
 #endif
+#ifdef DAP_CONFIG_ENABLE_GANG
+  HAL_GPIO_GANG_SWDIO_0_in();
+  HAL_GPIO_GANG_SWDIO_1_in();
+  HAL_GPIO_GANG_SWDIO_2_in();
+  HAL_GPIO_GANG_SWDIO_3_in();
+  HAL_GPIO_GANG_SWDIO_4_in();
+  HAL_GPIO_GANG_SWDIO_5_in();
+  HAL_GPIO_GANG_SWDIO_6_in();
+  HAL_GPIO_GANG_SWDIO_7_in();
+#endif
 }
 
 //-----------------------------------------------------------------------------
@@ -224,6 +323,12 @@ static inline void DAP_CONFIG_LED(int index, int state)
   (void)state;
 }
 
+//-----------------------------------------------------------------------------
+static inline uint32_t DAP_CONFIG_TIMER_US(void)
+{
+  return TIMER->TIMERAWL;
+}
+
 //-----------------------------------------------------------------------------
 __attribute__((always_inline))
 static inline void DAP_CONFIG_DELAY(uint32_t cycles)
@@ -8,11 +8,31 @@
 #include "hal_gpio.h"
 
 /*- Definitions -------------------------------------------------------------*/
+#if defined(DAP_CONFIG_INSTANCE) && DAP_CONFIG_INSTANCE == 2
+HAL_GPIO_PIN(SWCLK_TCK,      0, 16, sio_16)
+HAL_GPIO_PIN(SWDIO_TMS,      0, 17, sio_17)
+HAL_GPIO_PIN(TDI,            0, 18, sio_18)
+HAL_GPIO_PIN(TDO,            0, 19, sio_19)
+HAL_GPIO_PIN(nRESET,         0, 20, sio_20)
+#else
 HAL_GPIO_PIN(SWCLK_TCK,      0, 11, sio_11)
 HAL_GPIO_PIN(SWDIO_TMS,      0, 12, sio_12)
 HAL_GPIO_PIN(TDI,            0, 13, sio_13)
 HAL_GPIO_PIN(TDO,            0, 14, sio_14)
 HAL_GPIO_PIN(nRESET,         0, 15, sio_15)
+#endif
+
+HAL_GPIO_PIN(GANG_SWDIO_0,   0, 3, sio_3)
+HAL_GPIO_PIN(GANG_SWDIO_1,   0, 4, sio_4)
+HAL_GPIO_PIN(GANG_SWDIO_2,   0, 5, sio_5)
+HAL_GPIO_PIN(GANG_SWDIO_3,   0, 6, sio_6)
+HAL_GPIO_PIN(GANG_SWDIO_4,   0, 7, sio_7)
+HAL_GPIO_PIN(GANG_SWDIO_5,   0, 8, sio_8)
+HAL_GPIO_PIN(GANG_SWDIO_6,   0, 9, sio_9)
+HAL_GPIO_PIN(GANG_SWDIO_7,   0, 10, sio_10)
+
+#define GANG_SWDIO_SHIFT     3
+#define GANG_SWDIO_MASK      (0xff << GANG_SWDIO_SHIFT)
 
 HAL_GPIO_PIN(VCP_STATUS,     0, 2, sio_2);
 HAL_GPIO_PIN(DAP_STATUS,     0, 25, sio_25);
@@ -24,7 +44,12 @@ HAL_GPIO_PIN(UART_RX,        0, 1, uart0_rx)
 #define UART_RESET_MASK      RESETS_RESET_uart0_Msk
 #define UART_IRQ_INDEX       UART0_IRQ_IRQn
 #define UART_IRQ_HANDLER     irq_handler_uart0
-#define UART_CLOCK           120000000
+
+#if F_CPU == 240000000
+  #define UART_CLOCK         48000000 // clk_peri runs from the USB PLL
+#else
+  #define UART_CLOCK         F_CPU
+#endif
 
 #endif // _HAL_CONFIG_H_
 
@@ -11,24 +11,46 @@
 #include "usb.h"
 #include "uart.h"
 #include "dap.h"
+#include "dap2.h"
 #include "dap_config.h"
 
 /*- Definitions -------------------------------------------------------------*/
+#define ARRAY_SIZE(x)          ((int)(sizeof(x) / sizeof(0[x])))
 #define USB_BUFFER_SIZE        64
+#define USB_BULK_EP_SIZE       64
+#define HID_REPORT_SIZE        64
 #define UART_WAIT_TIMEOUT      10 // ms
 #define STATUS_TIMEOUT         250 // ms
+#define CORE1_STACK_SIZE       4096 // bytes, measured worst case is below 1 KB
 
 #define F_REF          12000000
-#define F_CPU          120000000
-#define F_PER          120000000
 #define F_RTC          (F_REF / 256)
 #define F_TICK         1000000
 
+#if F_CPU == 120000000
+  #define PLL_SYS_FBDIV      40  // VCO = 480 MHz
+  #define PLL_SYS_POSTDIV1   4
+  #define PLL_SYS_POSTDIV2   1
+  #define F_PER              F_CPU
+#elif F_CPU == 240000000
+  #define PLL_SYS_FBDIV      120 // VCO = 1440 MHz
+  #define PLL_SYS_POSTDIV1   6
+  #define PLL_SYS_POSTDIV2   1
+  #define F_PER              48000000 // clk_peri is limited to 133 MHz, use USB PLL
+  #define VREG_VSEL          12 // 1.15 V
+  #define XIP_SSI_DIV        6  // 40 MHz flash clock
+#else
+  #error Unsupported F_CPU value
+#endif
+
 /*- Variables ---------------------------------------------------------------*/
-static uint8_t app_req_buf_hid[DAP_CONFIG_PACKET_SIZE];
-static uint8_t app_resp_buf_hid[DAP_CONFIG_PACKET_SIZE];
+static uint8_t app_req_buf_hid[HID_REPORT_SIZE];
+static uint8_t app_resp_buf_hid[HID_REPORT_SIZE];
 static uint8_t app_req_buf_bulk[DAP_CONFIG_PACKET_SIZE];
 static uint8_t app_resp_buf_bulk[DAP_CONFIG_PACKET_SIZE];
+static uint8_t app_req_buf_bulk_2[DAP_CONFIG_PACKET_SIZE];
+static uint8_t app_resp_buf_bulk_2[DAP_CONFIG_PACKET_SIZE];
+static uint32_t app_core1_stack[CORE1_STACK_SIZE / sizeof(uint32_t)] __attribute__((aligned(8)));
 static uint8_t app_recv_buffer[USB_BUFFER_SIZE];
 static uint8_t app_send_buffer[USB_BUFFER_SIZE];
 static int app_recv_buffer_size = 0;
@@ -41,6 +63,9 @@ static uint64_t app_uart_timeout = 0;
 static uint64_t app_status_timeout = 0;
 static uint64_t app_break_timeout = 0;
 static bool app_dap_event = false;
+static bool app_bulk_send_busy = false;
+static bool app_bulk_recv_busy = false;
+static int app_bulk_req_size = -1;
 static bool app_vcp_event = false;
 static bool app_vcp_open = false;
 
@@ -55,13 +80,28 @@ static void sys_init(void)
   XOSC_SET->CTRL = (XOSC_CTRL_ENABLE_ENABLE << XOSC_CTRL_ENABLE_Pos);
   while (0 == (XOSC->STATUS & XOSC_STATUS_STABLE_Msk));
 
-  // Setup SYS PLL for 12 MHz * 40 / 4 / 1 = 120 MHz
+#ifdef VREG_VSEL
+  // Raise core voltage before increasing the clock frequency
+  VREG_AND_CHIP_RESET->VREG = (VREG_AND_CHIP_RESET->VREG & ~VREG_AND_CHIP_RESET_VREG_VSEL_Msk) |
+      (VREG_VSEL << VREG_AND_CHIP_RESET_VREG_VSEL_Pos);
+  while (0 == (VREG_AND_CHIP_RESET->VREG & VREG_AND_CHIP_RESET_VREG_ROK_Msk));
+#endif
+
+#ifdef XIP_SSI_DIV
+  // Keep flash clock within the limits for the READ_DATA command. The code is
+  // executed from RAM, so it is safe to disable XIP here.
+  XIP_SSI->SSIENR = 0;
+  XIP_SSI->BAUDR = XIP_SSI_DIV;
+  XIP_SSI->SSIENR = XIP_SSI_SSIENR_SSI_EN_Msk;
+#endif
+
+  // Setup SYS PLL for 12 MHz * FBDIV / POSTDIV1 / POSTDIV2 = F_CPU
   RESETS_CLR->RESET = RESETS_RESET_pll_sys_Msk;
   while (0 == RESETS->RESET_DONE_b.pll_sys);
 
   PLL_SYS->CS = (1 << PLL_SYS_CS_REFDIV_Pos);
-  PLL_SYS->FBDIV_INT = 40;
-  PLL_SYS->PRIM = (4 << PLL_SYS_PRIM_POSTDIV1_Pos) | (1 << PLL_SYS_PRIM_POSTDIV2_Pos);
+  PLL_SYS->FBDIV_INT = PLL_SYS_FBDIV;
+  PLL_SYS->PRIM = (PLL_SYS_POSTDIV1 << PLL_SYS_PRIM_POSTDIV1_Pos) | (PLL_SYS_POSTDIV2 << PLL_SYS_PRIM_POSTDIV2_Pos);
 
   PLL_SYS_CLR->PWR = PLL_SYS_PWR_VCOPD_Msk | PLL_SYS_PWR_PD_Msk;
   while (0 == PLL_SYS->CS_b.LOCK);
@@ -87,8 +127,13 @@ static void sys_init(void)
   CLOCKS->CLK_SYS_CTRL = (CLOCKS_CLK_SYS_CTRL_AUXSRC_clksrc_pll_sys << CLOCKS_CLK_SYS_CTRL_AUXSRC_Pos);
   CLOCKS_SET->CLK_SYS_CTRL = (CLOCKS_CLK_SYS_CTRL_SRC_clksrc_clk_sys_aux << CLOCKS_CLK_SYS_CTRL_SRC_Pos);
 
+#if F_PER == F_CPU
   CLOCKS->CLK_PERI_CTRL = CLOCKS_CLK_PERI_CTRL_ENABLE_Msk |
       (CLOCKS_CLK_PERI_CTRL_AUXSRC_clk_sys << CLOCKS_CLK_PERI_CTRL_AUXSRC_Pos);
+#else
+  CLOCKS->CLK_PERI_CTRL = CLOCKS_CLK_PERI_CTRL_ENABLE_Msk |
+      (CLOCKS_CLK_PERI_CTRL_AUXSRC_clksrc_pll_usb << CLOCKS_CLK_PERI_CTRL_AUXSRC_Pos);
+#endif
 
   CLOCKS->CLK_USB_CTRL = CLOCKS_CLK_USB_CTRL_ENABLE_Msk |
       (CLOCKS_CLK_USB_CTRL_AUXSRC_clksrc_pll_usb << CLOCKS_CLK_USB_CTRL_AUXSRC_Pos);
@@ -103,9 +148,10 @@ static void sys_init(void)
   // Configure 1 us tick for watchdog and timer
   WATCHDOG->TICK = ((F_REF/F_TICK) << WATCHDOG_TICK_CYCLES_Pos) | WATCHDOG_TICK_ENABLE_Msk;
 
-  // Enable GPIOs
-  RESETS_CLR->RESET = RESETS_RESET_io_bank0_Msk | RESETS_RESET_pads_bank0_Msk;
-  while (0 == RESETS->RESET_DONE_b.io_bank0 || 0 == RESETS->RESET_DONE_b.pads_bank0);
+  // Enable GPIOs and timer
+  RESETS_CLR->RESET = RESETS_RESET_io_bank0_Msk | RESETS_RESET_pads_bank0_Msk | RESETS_RESET_timer_Msk;
+  while (0 == RESETS->RESET_DONE_b.io_bank0 || 0 == RESETS->RESET_DONE_b.pads_bank0 ||
+      0 == RESETS->RESET_DONE_b.timer);
 }
 
 //-----------------------------------------------------------------------------
@@ -123,6 +169,59 @@ static void serial_number_init(void)
   usb_serial_number[8] = 0;
 }
 
+//-----------------------------------------------------------------------------
+static void core1_main(void)
+{
+  dap2_init();
+
+  // Requests for the second DAP instance are passed through the inter-core
+  // FIFO. The request size goes in and the response size comes back.
+  while (1)
+  {
+    int size;
+
+    while (0 == (SIO->FIFO_ST & SIO_FIFO_ST_VLD_Msk))
+      dap2_background_task();
+
+    size = dap2_process_request(app_req_buf_bulk_2, SIO->FIFO_RD,
+        app_resp_buf_bulk_2, sizeof(app_resp_buf_bulk_2));
+
+    __DMB();
+    SIO->FIFO_WR = size;
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void core1_init(void)
+{
+  uint32_t cmd[] = { 0, 0, 1, SCB->VTOR, (uint32_t)&app_core1_stack[ARRAY_SIZE(app_core1_stack)],
+      (uint32_t)core1_main };
+  int i = 0;
+
+  PSM_SET->FRCE_OFF = PSM_FRCE_OFF_proc1_Msk;
+  while (0 == (PSM->FRCE_OFF & PSM_FRCE_OFF_proc1_Msk));
+  PSM_CLR->FRCE_OFF = PSM_FRCE_OFF_proc1_Msk;
+
+  // Boot ROM launch sequence, each value must be echoed back by the core 1
+  while (i < ARRAY_SIZE(cmd))
+  {
+    if (0 == cmd[i])
+    {
+      while (SIO->FIFO_ST & SIO_FIFO_ST_VLD_Msk)
+        (void)SIO->FIFO_RD;
+
+      __SEV();
+    }
+
+    while (0 == (SIO->FIFO_ST & SIO_FIFO_ST_RDY_Msk));
+    SIO->FIFO_WR = cmd[i];
+    __SEV();
+
+    while (0 == (SIO->FIFO_ST & SIO_FIFO_ST_VLD_Msk));
+    i = (SIO->FIFO_RD == cmd[i]) ? (i + 1) : 0;
+  }
+}
+
 //-----------------------------------------------------------------------------
 static void sys_time_init(void)
 {
@@ -139,9 +238,52 @@ static void sys_time_task(void)
     app_system_time++;
 }
 
+//-----------------------------------------------------------------------------
+static bool bridge_active(void)
+{
+  return dap_rtt_active() || dap_semihost_active();
+}
+
+//-----------------------------------------------------------------------------
+static int bridge_read(uint8_t *data, int size)
+{
+  int count = dap_rtt_read(data, size);
+
+  return count + dap_semihost_read(&data[count], size - count);
+}
+
+//-----------------------------------------------------------------------------
+static int bridge_write(uint8_t *data, int size)
+{
+  // RTT takes the input when both bridges are active
+  if (dap_rtt_active())
+    return dap_rtt_write(data, size);
+
+  return dap_semihost_write(data, size);
+}
+
 //-----------------------------------------------------------------------------
 static void tx_task(void)
 {
+  // While a target bridge is active, VCP data goes to the target instead of the UART
+  if (bridge_active())
+  {
+    if (app_recv_buffer_size)
+    {
+      int size = bridge_write(&app_recv_buffer[app_recv_buffer_ptr], app_recv_buffer_size);
+
+      app_recv_buffer_ptr += size;
+      app_recv_buffer_size -= size;
+      if (size)
+        app_vcp_event = true;
+
+      if (0 == app_recv_buffer_size)
+        usb_cdc_recv(app_recv_buffer, sizeof(app_recv_buffer));
+    }
+
+    return;
+  }
+
   while (app_recv_buffer_size)
   {
     if (!uart_write_byte(app_recv_buffer[app_recv_buffer_ptr]))
@@ -175,6 +317,24 @@ static void rx_task(void)
   if (!app_send_buffer_free)
     return;
 
+  // While a target bridge is active, VCP data comes from the target instead of the UART
+  if (bridge_active())
+  {
+    int size = bridge_read(&app_send_buffer[app_send_buffer_ptr], USB_BUFFER_SIZE - app_send_buffer_ptr);
+
+    if (size)
+    {
+      app_send_buffer_ptr += size;
+      app_uart_timeout = app_system_time + UART_WAIT_TIMEOUT;
+      app_vcp_event = true;
+
+      if (USB_BUFFER_SIZE == app_send_buffer_ptr)
+        send_buffer();
+    }
+
+    return;
+  }
+
   while (uart_read_byte(&byte))
   {
     int state = (byte >> 8) & 0xff;
@@ -279,7 +439,7 @@ void usb_cdc_recv_callback(int size)
 //-----------------------------------------------------------------------------
 void usb_hid_send_callback(void)
 {
-  usb_hid_recv(app_req_buf_hid, DAP_CONFIG_PACKET_SIZE);
+  usb_hid_recv(app_req_buf_hid, sizeof(app_req_buf_hid));
 }
 
 //-----------------------------------------------------------------------------
@@ -292,19 +452,117 @@ void usb_hid_recv_callback(int size)
   (void)size;
 }
 
+//-----------------------------------------------------------------------------
+static int usb_bulk_size(int size)
+{
+  // Responses end with a short packet, the host ignores the extra byte
+  if (size < DAP_CONFIG_PACKET_SIZE && 0 == (size % USB_BULK_EP_SIZE))
+    size++;
+
+  return size;
+}
+
+//-----------------------------------------------------------------------------
+static void usb_bulk_process(int size)
+{
+  // A request that was completed early may be followed by a ZLP from the host
+  if (0 == size)
+  {
+    usb_recv(USB_BULK_EP_RECV, app_req_buf_bulk, sizeof(app_req_buf_bulk));
+    app_bulk_recv_busy = true;
+    return;
+  }
+
+  size = dap_process_request(app_req_buf_bulk, size,
+      app_resp_buf_bulk, sizeof(app_resp_buf_bulk));
+
+  // Stream credit and data packets have no response
+  if (0 == size)
+  {
+    usb_recv(USB_BULK_EP_RECV, app_req_buf_bulk, sizeof(app_req_buf_bulk));
+    app_bulk_recv_busy = true;
+  }
+  else
+  {
+    usb_send(USB_BULK_EP_SEND, app_resp_buf_bulk, usb_bulk_size(size));
+    app_bulk_send_busy = true;
+  }
+}
+
 //-----------------------------------------------------------------------------
 static void usb_bulk_send_callback(void)
 {
-  usb_recv(USB_BULK_EP_RECV, app_req_buf_bulk, sizeof(app_req_buf_bulk));
+  app_bulk_send_busy = false;
+
+  if (app_bulk_req_size >= 0)
+  {
+    int size = app_bulk_req_size;
+
+    app_bulk_req_size = -1;
+    usb_bulk_process(size);
+  }
+  else if (!app_bulk_recv_busy)
+  {
+    usb_recv(USB_BULK_EP_RECV, app_req_buf_bulk, sizeof(app_req_buf_bulk));
+    app_bulk_recv_busy = true;
+  }
 }
 
 //-----------------------------------------------------------------------------
 static void usb_bulk_recv_callback(int size)
 {
   app_dap_event = true;
-  size = dap_process_request(app_req_buf_bulk, size,
-      app_resp_buf_bulk, sizeof(app_resp_buf_bulk));
-  usb_send(USB_BULK_EP_SEND, app_resp_buf_bulk, size);
+  app_bulk_recv_busy = false;
+
+  // The response buffer is in use until the stream packet is sent
+  if (app_bulk_send_busy)
+    app_bulk_req_size = size;
+  else
+    usb_bulk_process(size);
+}
+
+//-----------------------------------------------------------------------------
+static void stream_task(void)
+{
+  int size;
+
+  if (app_bulk_send_busy)
+    return;
+
+  size = dap_stream_task(app_resp_buf_bulk, sizeof(app_resp_buf_bulk));
+
+  if (size)
+  {
+    usb_send(USB_BULK_EP_SEND, app_resp_buf_bulk, usb_bulk_size(size));
+    app_bulk_send_busy = true;
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void usb_bulk_2_send_callback(void)
+{
+  usb_recv(USB_BULK_2_EP_RECV, app_req_buf_bulk_2, sizeof(app_req_buf_bulk_2));
+}
+
+//-----------------------------------------------------------------------------
+static void usb_bulk_2_recv_callback(int size)
+{
+  if (0 == size)
+  {
+    usb_recv(USB_BULK_2_EP_RECV, app_req_buf_bulk_2, sizeof(app_req_buf_bulk_2));
+    return;
+  }
+
+  app_dap_event = true;
+  __DMB();
+  SIO->FIFO_WR = size;
+}
+
+//-----------------------------------------------------------------------------
+static void dap_2_task(void)
+{
+  if (SIO->FIFO_ST & SIO_FIFO_ST_VLD_Msk)
+    usb_send(USB_BULK_2_EP_SEND, app_resp_buf_bulk_2, usb_bulk_size(SIO->FIFO_RD));
 }
 
 //-----------------------------------------------------------------------------
@@ -312,10 +570,19 @@ void usb_configuration_callback(int config)
 {
   usb_set_send_callback(USB_BULK_EP_SEND, usb_bulk_send_callback);
   usb_set_recv_callback(USB_BULK_EP_RECV, usb_bulk_recv_callback);
+  usb_set_send_callback(USB_BULK_2_EP_SEND, usb_bulk_2_send_callback);
+  usb_set_recv_callback(USB_BULK_2_EP_RECV, usb_bulk_2_recv_callback);
+  usb_set_recv_complete(USB_BULK_EP_RECV, dap_request_complete);
+  usb_set_recv_complete(USB_BULK_2_EP_RECV, dap2_request_complete);
 
   usb_cdc_recv(app_recv_buffer, sizeof(app_recv_buffer));
   usb_hid_recv(app_req_buf_hid, sizeof(app_req_buf_hid));
   usb_recv(USB_BULK_EP_RECV, app_req_buf_bulk, sizeof(app_req_buf_bulk));
+  usb_recv(USB_BULK_2_EP_RECV, app_req_buf_bulk_2, sizeof(app_req_buf_bulk_2));
+
+  app_bulk_send_busy = false;
+  app_bulk_recv_busy = true;
+  app_bulk_req_size = -1;
 
   app_send_buffer_free = true;
   app_send_buffer_ptr = 0;
@@ -351,6 +618,7 @@ int main(void)
   sys_init();
   sys_time_init();
   dap_init();
+  core1_init();
   usb_init();
   usb_cdc_init();
   usb_hid_init();
@@ -368,6 +636,9 @@ int main(void)
   {
     sys_time_task();
     usb_task();
+    dap_2_task();
+    stream_task();
+    dap_background_task();
     tx_task();
     rx_task();
     break_task();
@@ -21,6 +21,7 @@ void usb_endpoint_clear_feature(int ep, int dir);
 void usb_set_address(int address);
 void usb_send(int ep, uint8_t *data, int size);
 void usb_recv(int ep, uint8_t *data, int size);
+void usb_set_recv_complete(int ep, bool (*callback)(uint8_t *data, int size));
 void usb_control_send_zlp(void);
 void usb_control_stall(void);
 void usb_control_send(uint8_t *data, int size);
@@ -38,10 +38,17 @@ typedef struct
 typedef struct
 {
   int      in_pid;
+  int      in_size;
+  int      in_max_size;
   volatile uint8_t *in_buf;
+  uint8_t  *in_data;
   int      out_pid;
+  int      out_size;
+  int      out_ptr;
+  int      out_max_size;
   volatile uint8_t *out_buf;
   uint8_t  *out_data;
+  bool     (*out_complete)(uint8_t *data, int size);
 } usb_ep_t;
 
 /*- Variables ---------------------------------------------------------------*/
@@ -119,6 +126,11 @@ void usb_configure_endpoint(usb_endpoint_descriptor_t *desc)
   type = desc->bmAttributes & 0x03;
   size = desc->wMaxPacketSize & 0x3ff;
 
+  if (USB_IN_ENDPOINT == dir)
+    usb_ep[ep].in_max_size = size;
+  else
+    usb_ep[ep].out_max_size = size;
+
   if (size <= 64)
     size = 64;
   else if (size <= 128)
@@ -230,19 +242,45 @@ static void usb_start_out_transfer(int ep, int size)
 }
 
 //-----------------------------------------------------------------------------
-void usb_send(int ep, uint8_t *data, int size)
+static void usb_send_packet(int ep)
 {
+  int size = USB_LIMIT(usb_ep[ep].in_size, usb_ep[ep].in_max_size);
+
   for (int i = 0; i < size; i++)
-    usb_ep[ep].in_buf[i] = data[i];
+    usb_ep[ep].in_buf[i] = usb_ep[ep].in_data[i];
+
+  usb_ep[ep].in_data += size;
+  usb_ep[ep].in_size -= size;
 
   usb_start_in_transfer(ep, size);
 }
 
+//-----------------------------------------------------------------------------
+void usb_send(int ep, uint8_t *data, int size)
+{
+  // Transfers larger than the endpoint size are split into multiple packets,
+  // the data buffer must stay valid until the send callback
+  usb_ep[ep].in_data = data;
+  usb_ep[ep].in_size = size;
+
+  usb_send_packet(ep);
+}
+
 //-----------------------------------------------------------------------------
 void usb_recv(int ep, uint8_t *data, int size)
 {
   usb_ep[ep].out_data = data;
-  usb_start_out_transfer(ep, size);
+  usb_ep[ep].out_size = size;
+  usb_ep[ep].out_ptr  = 0;
+
+  usb_start_out_transfer(ep, usb_ep[ep].out_max_size);
+}
+
+//-----------------------------------------------------------------------------
+void usb_set_recv_complete(int ep, bool (*callback)(uint8_t *data, int size))
+{
+  // Lets a transfer that is a multiple of the endpoint size end without a ZLP
+  usb_ep[ep].out_complete = callback;
 }
 
 //-----------------------------------------------------------------------------
@@ -353,17 +391,31 @@ void usb_task(void)
     {
       if (flags & 1) // IN
       {
-        usb_send_callback(ep);
+        if (usb_ep[ep].in_size)
+          usb_send_packet(ep);
+        else
+          usb_send_callback(ep);
       }
 
       if (flags & 2) // OUT
       {
         int size = USB_DPRAM->EP_BUF_CTRL[ep].OUT & USBCTRL_DPRAM_EP0_OUT_BUFFER_CONTROL_LENGTH_0_Msk;
+        int ptr = usb_ep[ep].out_ptr;
+
+        size = USB_LIMIT(size, usb_ep[ep].out_size - ptr);
 
         for (int i = 0; i < size; i++)
-          usb_ep[ep].out_data[i] = usb_ep[ep].out_buf[i];
+          usb_ep[ep].out_data[ptr + i] = usb_ep[ep].out_buf[i];
+
+        usb_ep[ep].out_ptr += size;
 
-        usb_recv_callback(ep, size);
+        // The transfer ends with a short packet, when the buffer is full or when
+        // the received data is known to be complete
+        if (size == usb_ep[ep].out_max_size && usb_ep[ep].out_ptr < usb_ep[ep].out_size &&
+            !(usb_ep[ep].out_complete && usb_ep[ep].out_complete(usb_ep[ep].out_data, usb_ep[ep].out_ptr)))
+          usb_start_out_transfer(ep, usb_ep[ep].out_max_size);
+        else
+          usb_recv_callback(ep, usb_ep[ep].out_ptr);
       }
 
       flags >>= 2;
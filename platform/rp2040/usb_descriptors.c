@@ -219,6 +219,40 @@ const alignas(4) usb_configuration_hierarchy_t usb_configuration_hierarchy =
     .wMaxPacketSize      = 64,
     .bInterval           = 0,
   },
+
+  // CMSIS-DAP v2 (second instance)
+  .bulk_2_interface =
+  {
+    .bLength             = sizeof(usb_interface_descriptor_t),
+    .bDescriptorType     = USB_INTERFACE_DESCRIPTOR,
+    .bInterfaceNumber    = USB_INTF_BULK_2,
+    .bAlternateSetting   = 0,
+    .bNumEndpoints       = 2,
+    .bInterfaceClass     = USB_DEVICE_CLASS_VENDOR_SPECIFIC,
+    .bInterfaceSubClass  = 0,
+    .bInterfaceProtocol  = 0,
+    .iInterface          = USB_STR_CMSIS_DAP_V2_2,
+  },
+
+  .bulk_2_ep_out =
+  {
+    .bLength             = sizeof(usb_endpoint_descriptor_t),
+    .bDescriptorType     = USB_ENDPOINT_DESCRIPTOR,
+    .bEndpointAddress    = USB_OUT_ENDPOINT | USB_BULK_2_EP_RECV,
+    .bmAttributes        = USB_BULK_ENDPOINT,
+    .wMaxPacketSize      = 64,
+    .bInterval           = 0,
+  },
+
+  .bulk_2_ep_in =
+  {
+    .bLength             = sizeof(usb_endpoint_descriptor_t),
+    .bDescriptorType     = USB_ENDPOINT_DESCRIPTOR,
+    .bEndpointAddress    = USB_IN_ENDPOINT | USB_BULK_2_EP_SEND,
+    .bmAttributes        = USB_BULK_ENDPOINT,
+    .wMaxPacketSize      = 64,
+    .bInterval           = 0,
+  },
 };
 
 const alignas(4) usb_bos_hierarchy_t usb_bos_hierarchy =
@@ -289,6 +323,41 @@ const alignas(4) usb_msos_descriptor_set_t usb_msos_descriptor_set =
           '6',0,'4',0,'6',0,'3',0,'7',0,'7',0,'6',0,'}',0, 0, 0, 0, 0 },
     },
   },
+
+  .subset_2 =
+  {
+    .header = {
+      .wLength           = sizeof(usb_winusb_subset_header_function_t),
+      .wDescriptorType   = USB_WINUSB_SUBSET_HEADER_FUNCTION,
+      .bFirstInterface   = USB_INTF_BULK_2,
+      .bReserved         = 0,
+      .wSubsetLength     = sizeof(usb_msos_descriptor_subset_t),
+    },
+
+    .comp_id =
+    {
+      .wLength           = sizeof(usb_winusb_feature_compatble_id_t),
+      .wDescriptorType   = USB_WINUSB_FEATURE_COMPATBLE_ID,
+      .CompatibleID      = "WINUSB\0\0",
+      .SubCompatibleID   = { 0 },
+    },
+
+    .property =
+    {
+      .wLength             = sizeof(usb_winusb_feature_reg_property_guids_t),
+      .wDescriptorType     = USB_WINUSB_FEATURE_REG_PROPERTY,
+      .wPropertyDataType   = USB_WINUSB_PROPERTY_DATA_TYPE_MULTI_SZ,
+      .wPropertyNameLength = sizeof(usb_msos_descriptor_set.subset_2.property.PropertyName),
+      .PropertyName        = {
+          'D',0,'e',0,'v',0,'i',0,'c',0,'e',0,'I',0,'n',0,'t',0,'e',0,'r',0,'f',0,'a',0,'c',0,'e',0,
+          'G',0,'U',0,'I',0,'D',0,'s',0, 0, 0 },
+      .wPropertyDataLength = sizeof(usb_msos_descriptor_set.subset_2.property.PropertyData),
+      .PropertyData        = {
+          '{',0,'C',0,'D',0,'B',0,'3',0,'B',0,'5',0,'A',0,'D',0,'-',0,'2',0,'9',0,'3',0,'B',0,'-',0,
+          '4',0,'6',0,'6',0,'3',0,'-',0,'A',0,'A',0,'3',0,'6',0,'-',0,'1',0,'A',0,'A',0,'E',0,'4',0,
+          '6',0,'4',0,'6',0,'3',0,'7',0,'7',0,'6',0,'}',0, 0, 0, 0, 0 },
+    },
+  },
 };
 
 const alignas(4) uint8_t usb_hid_report_descriptor[28] =
@@ -323,6 +392,7 @@ const char *usb_strings[] =
   [USB_STR_COM_PORT]      = "Virtual COM-Port",
   [USB_STR_CMSIS_DAP_V1]  = "CMSIS-DAP v1 Adapter",
   [USB_STR_CMSIS_DAP_V2]  = "CMSIS-DAP v2 Adapter",
+  [USB_STR_CMSIS_DAP_V2_2] = "CMSIS-DAP v2 Adapter (Port 2)",
   [USB_STR_SERIAL_NUMBER] = usb_serial_number,
 };
 
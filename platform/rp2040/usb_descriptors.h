@@ -23,6 +23,7 @@ enum
   USB_STR_CMSIS_DAP_V1,
   USB_STR_CMSIS_DAP_V2,
   USB_STR_COM_PORT,
+  USB_STR_CMSIS_DAP_V2_2,
   USB_STR_COUNT,
 };
 
@@ -35,6 +36,8 @@ enum
   USB_CDC_EP_COMM  = 5,
   USB_CDC_EP_SEND  = 6,
   USB_CDC_EP_RECV  = 7,
+  USB_BULK_2_EP_RECV = 8,
+  USB_BULK_2_EP_SEND = 9,
 };
 
 enum
@@ -43,6 +46,7 @@ enum
   USB_INTF_BULK,
   USB_INTF_CDC_COMM,
   USB_INTF_CDC_DATA,
+  USB_INTF_BULK_2,
   USB_INTF_COUNT,
 };
 
@@ -70,6 +74,10 @@ typedef struct USB_PACK
   usb_interface_descriptor_t                       interface_data;
   usb_endpoint_descriptor_t                        ep_in;
   usb_endpoint_descriptor_t                        ep_out;
+
+  usb_interface_descriptor_t                       bulk_2_interface;
+  usb_endpoint_descriptor_t                        bulk_2_ep_out;
+  usb_endpoint_descriptor_t                        bulk_2_ep_in;
 } usb_configuration_hierarchy_t;
 
 typedef struct USB_PACK
@@ -89,6 +97,7 @@ typedef struct USB_PACK
 {
   usb_winusb_set_header_descriptor_t               header;
   usb_msos_descriptor_subset_t                     subset;
+  usb_msos_descriptor_subset_t                     subset_2;
 } usb_msos_descriptor_set_t;
 
 //-----------------------------------------------------------------------------
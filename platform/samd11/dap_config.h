@@ -29,6 +29,9 @@
 // Attribute to use for performance-critical functions
 #define DAP_CONFIG_PERFORMANCE_ATTR    __attribute__((section(".ramfunc")))
 
+// Attribute to use for the transfer command handlers, they do not fit into 4 KB of RAM
+#define DAP_CONFIG_TRANSFER_ATTR
+
 // A value at which dap_clock_test() produces 1 kHz output on the SWCLK pin
 #define DAP_CONFIG_DELAY_CONSTANT      7700
 
@@ -12,7 +12,12 @@
 #define DAP_CONFIG_DEFAULT_PORT        DAP_PORT_SWD
 #define DAP_CONFIG_DEFAULT_CLOCK       1000000 // Hz
 
-#define DAP_CONFIG_PACKET_SIZE         64
+// Large bulk packets need a host that terminates requests with a zero-length packet
+#ifdef USE_LARGE_PACKETS
+  #define DAP_CONFIG_PACKET_SIZE       512
+#else
+  #define DAP_CONFIG_PACKET_SIZE       64
+#endif
 #define DAP_CONFIG_PACKET_COUNT        2
 
 #define DAP_CONFIG_JTAG_DEV_COUNT      8
@@ -29,6 +34,9 @@
 // Attribute to use for performance-critical functions
 #define DAP_CONFIG_PERFORMANCE_ATTR    __attribute__((section(".ramfunc")))
 
+// Attribute to use for the transfer command handlers
+#define DAP_CONFIG_TRANSFER_ATTR       __attribute__((section(".ramfunc")))
+
 // A value at which dap_clock_test() produces 1 kHz output on the SWCLK pin
 #define DAP_CONFIG_DELAY_CONSTANT      7700
 
@@ -17,11 +17,13 @@
 
 /*- Definitions -------------------------------------------------------------*/
 #define USB_BUFFER_SIZE        64
+#define USB_BULK_EP_SIZE       64
+#define HID_REPORT_SIZE        64
 #define UART_WAIT_TIMEOUT      10 // ms
 #define STATUS_TIMEOUT         250 // ms
 
 /*- Variables ---------------------------------------------------------------*/
-static alignas(4) uint8_t app_req_buf_hid[DAP_CONFIG_PACKET_SIZE];
+static alignas(4) uint8_t app_req_buf_hid[HID_REPORT_SIZE];
 static alignas(4) uint8_t app_req_buf_bulk[DAP_CONFIG_PACKET_SIZE];
 static alignas(4) uint8_t app_req_buf[DAP_CONFIG_PACKET_SIZE];
 static alignas(4) uint8_t app_resp_buf[DAP_CONFIG_PACKET_SIZE];
@@ -310,12 +312,22 @@ static void dap_task(void)
     return;
   }
 
-  size = dap_process_request(app_req_buf, size, app_resp_buf, sizeof(app_resp_buf));
-
   if (USB_INTF_BULK == interface)
+  {
+    size = dap_process_request(app_req_buf, size, app_resp_buf, sizeof(app_resp_buf));
+
+    // Bulk transfers span multiple packets, shorter responses must end with
+    // a short packet. The host ignores the extra byte.
+    if (size < DAP_CONFIG_PACKET_SIZE && 0 == (size % USB_BULK_EP_SIZE))
+      size++;
+
     usb_send(USB_BULK_EP_SEND, app_resp_buf, size);
+  }
   else
-    usb_hid_send(app_resp_buf, sizeof(app_resp_buf));
+  {
+    dap_process_request(app_req_buf, size, app_resp_buf, HID_REPORT_SIZE);
+    usb_hid_send(app_resp_buf, HID_REPORT_SIZE);
+  }
 
   app_resp_free = false;
   app_dap_event = true;
@@ -33,7 +33,14 @@ HAL_GPIO_PIN(nRESET,       D, 22)
 //#define DAP_CONFIG_VENDOR_FN           vendor_command_handler_function
 
 // Attribute to use for performance-critical functions
+#ifdef USE_ITCM
+#define DAP_CONFIG_PERFORMANCE_ATTR    __attribute__((section(".itcm")))
+#else
 #define DAP_CONFIG_PERFORMANCE_ATTR    __attribute__((section(".ramfunc")))
+#endif
+
+// Attribute to use for the transfer command handlers
+#define DAP_CONFIG_TRANSFER_ATTR       DAP_CONFIG_PERFORMANCE_ATTR
 
 // A value at which dap_clock_test() produces 1 kHz output on the SWCLK pin
 #define DAP_CONFIG_DELAY_CONSTANT      75000
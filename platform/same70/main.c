@@ -41,10 +41,19 @@
 
 /*- Definitions -------------------------------------------------------------*/
 #define STATUS_TIMEOUT         250 // ms
+#ifdef USE_ITCM
+#define TCM_CONFIG             1 // 32 KB ITCM and 32 KB DTCM
+#endif
 
 HAL_GPIO_PIN(LED,  D, 8)
 
 /*- Variables ---------------------------------------------------------------*/
+#ifdef USE_ITCM
+extern uint32_t _itcm;
+extern uint32_t _eitcm;
+extern uint32_t _itcm_load;
+#endif
+
 static uint8_t app_request_buffer[DAP_CONFIG_PACKET_COUNT][DAP_CONFIG_PACKET_SIZE];
 static bool app_request_valid[DAP_CONFIG_PACKET_COUNT];
 static bool app_request_pending;
@@ -102,6 +111,41 @@ static void sys_init(void)
   SCB_EnableICache();
 }
 
+#ifdef USE_ITCM
+//-----------------------------------------------------------------------------
+__attribute__ ((noinline, section(".ramfunc")))
+static uint32_t flash_command(uint32_t command, int arg)
+{
+  EFC->EEFC_FCR = EEFC_FCR_FKEY_PASSWD | EEFC_FCR_FARG(arg) | command;
+  while (0 == (EFC->EEFC_FSR & EEFC_FSR_FRDY));
+
+  return EFC->EEFC_FRR;
+}
+
+//-----------------------------------------------------------------------------
+static void tcm_init(void)
+{
+  uint32_t gpnvm = flash_command(EEFC_FCR_FCMD_GGPB, 0);
+  uint32_t *src = &_itcm_load;
+  uint32_t *dst = &_itcm;
+
+  // TCM size is set by GPNVM bits 7 and 8, the new value takes effect after a reset
+  if (TCM_CONFIG != ((gpnvm >> 7) & 3))
+  {
+    flash_command((TCM_CONFIG & 1) ? EEFC_FCR_FCMD_SGPB : EEFC_FCR_FCMD_CGPB, 7);
+    flash_command((TCM_CONFIG & 2) ? EEFC_FCR_FCMD_SGPB : EEFC_FCR_FCMD_CGPB, 8);
+    NVIC_SystemReset();
+  }
+
+  SCB->ITCMCR |= SCB_ITCMCR_EN_Msk;
+  __DSB();
+  __ISB();
+
+  while (dst < &_eitcm)
+    *dst++ = *src++;
+}
+#endif
+
 //-----------------------------------------------------------------------------
 __attribute__ ((noinline, section(".ramfunc")))
 static void read_uid(uint32_t *uid)
@@ -265,6 +309,9 @@ static void status_timer_task(void)
 //-----------------------------------------------------------------------------
 int main(void)
 {
+#ifdef USE_ITCM
+  tcm_init();
+#endif
   sys_init();
   timer_init();
   serial_number_init();